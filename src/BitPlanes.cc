@@ -0,0 +1,137 @@
+/*
+ BitPlanes.cc -- samples quantized against the pulse detection thresholds.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BitPlanes.h"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void BitPlanes::quantize(const int16_t *samples, size_t n, int32_t cutoff) {
+    auto words = (n + 63) / 64;
+    for (auto &plane : planes) {
+        plane.assign(words, 0);
+    }
+    length = n;
+    
+    size_t i = 0;
+    
+#ifdef __SSE2__
+    // Compare 16 samples at a time and collect the sign bits of the results.
+    auto above = _mm_set1_epi16(static_cast<int16_t>(cutoff));
+    auto below = _mm_set1_epi16(static_cast<int16_t>(-cutoff));
+    auto zero = _mm_setzero_si128();
+    
+    for (; i + 16 <= n; i += 16) {
+        auto low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(samples + i));
+        auto high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(samples + i + 8));
+        auto shift = i % 64;
+        auto word = i / 64;
+        
+        planes[ABOVE_CUTOFF][word] |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpgt_epi16(low, above), _mm_cmpgt_epi16(high, above)))) << shift;
+        planes[POSITIVE][word] |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpgt_epi16(low, zero), _mm_cmpgt_epi16(high, zero)))) << shift;
+        planes[NEGATIVE][word] |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_packs_epi16(_mm_cmplt_epi16(low, zero), _mm_cmplt_epi16(high, zero)))) << shift;
+        planes[BELOW_CUTOFF][word] |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_packs_epi16(_mm_cmplt_epi16(low, below), _mm_cmplt_epi16(high, below)))) << shift;
+    }
+#endif
+    
+    for (; i < n; i++) {
+        auto sample = samples[i];
+        auto bit = static_cast<uint64_t>(1) << (i % 64);
+        auto word = i / 64;
+        
+        if (sample > cutoff) {
+            planes[ABOVE_CUTOFF][word] |= bit;
+        }
+        if (sample > 0) {
+            planes[POSITIVE][word] |= bit;
+        }
+        if (sample < 0) {
+            planes[NEGATIVE][word] |= bit;
+        }
+        if (sample < -cutoff) {
+            planes[BELOW_CUTOFF][word] |= bit;
+        }
+    }
+}
+
+
+size_t BitPlanes::find_next(Plane plane1, Plane plane2, size_t start, size_t end) const {
+    if (start >= end) {
+        return end;
+    }
+    
+    auto &bits1 = planes[plane1];
+    auto &bits2 = planes[plane2];
+    auto index = start / 64;
+    auto word = (bits1[index] | bits2[index]) & (~static_cast<uint64_t>(0) << (start % 64));
+    
+    while (word == 0) {
+        index += 1;
+        if (index * 64 >= end) {
+            return end;
+        }
+        word = bits1[index] | bits2[index];
+    }
+    
+    return std::min(index * 64 + static_cast<size_t>(__builtin_ctzll(word)), end);
+}
+
+
+size_t BitPlanes::find_outside(const int16_t *samples, size_t n, int32_t cutoff) {
+    size_t i = 0;
+    
+#ifdef __SSE2__
+    // Check 32 samples at a time, then find the exact one in the scalar loop below.
+    auto above = _mm_set1_epi16(static_cast<int16_t>(cutoff));
+    auto below = _mm_set1_epi16(static_cast<int16_t>(-cutoff));
+    
+    for (; i + 32 <= n; i += 32) {
+        auto outside = _mm_setzero_si128();
+        for (size_t j = 0; j < 32; j += 8) {
+            auto values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(samples + i + j));
+            outside = _mm_or_si128(outside, _mm_or_si128(_mm_cmpgt_epi16(values, above), _mm_cmplt_epi16(values, below)));
+        }
+        if (_mm_movemask_epi8(outside) != 0) {
+            break;
+        }
+    }
+#endif
+    
+    for (; i < n; i++) {
+        if (samples[i] > cutoff || samples[i] < -cutoff) {
+            return i;
+        }
+    }
+    
+    return n;
+}
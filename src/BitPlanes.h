@@ -0,0 +1,68 @@
+/*
+ BitPlanes.h -- samples quantized against the pulse detection thresholds.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HAD_BIT_PLANES_H
+#define HAD_BIT_PLANES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Where each sample of a run lies relative to the detection thresholds, one bit per sample in each plane, packed into 64 bit words with the first sample in the least significant bit.
+class BitPlanes {
+public:
+    enum Plane {
+        ABOVE_CUTOFF, // sample > cutoff
+        POSITIVE, // sample > 0
+        NEGATIVE, // sample < 0
+        BELOW_CUTOFF, // sample < -cutoff
+        NUMBER_OF_PLANES
+    };
+    
+    BitPlanes() : length(0) { }
+    
+    void quantize(const int16_t *samples, size_t n, int32_t cutoff);
+    
+    size_t size() const { return length; }
+    bool test(Plane plane, size_t index) const { return (planes[plane][index / 64] >> (index % 64)) & 1; }
+    
+    // Index of the first sample in [start, end) that is set in one of the given planes, end if there is none.
+    size_t find_next(Plane plane, size_t start, size_t end) const { return find_next(plane, plane, start, end); }
+    size_t find_next(Plane plane1, Plane plane2, size_t start, size_t end) const;
+    
+    // Index of the first of n samples that is above cutoff or below -cutoff, n if there is none. Works on the samples directly, without quantizing them first.
+    static size_t find_outside(const int16_t *samples, size_t n, int32_t cutoff);
+    
+private:
+    std::vector<uint64_t> planes[NUMBER_OF_PLANES];
+    size_t length;
+};
+
+#endif // HAD_BIT_PLANES_H
@@ -30,12 +30,60 @@
 
 #include "BitVector.h"
 
-void BitVector::push_back(bool value) {
-    if (length % 8 == 0) {
-        store.push_back(0);
+#include <algorithm>
+
+void BitVector::append_bits(uint64_t value, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    if (n < 64) {
+        value &= (static_cast<uint64_t>(1) << n) - 1;
+    }
+    
+    auto offset = length % 64;
+    if (offset == 0) {
+        words.push_back(0);
+    }
+    auto available = 64 - offset;
+    
+    if (n <= available) {
+        words.back() |= value << (available - n);
     }
+    else {
+        words.back() |= value >> (n - available);
+        words.push_back(value << (64 - (n - available)));
+    }
+    length += n;
+}
+
 
-    uint8_t bit = value ? 1 : 0;
-    store[length/8] = store[length/8] | (bit << (7 - (length % 8)));
-    length += 1;
+std::vector<uint8_t> BitVector::bytes() const {
+    auto result = std::vector<uint8_t>((length + 7) / 8);
+    
+    for (size_t i = 0; i < result.size(); i++) {
+        result[i] = static_cast<uint8_t>(words[i / 8] >> (56 - 8 * (i % 8)));
+    }
+    
+    return result;
+}
+
+
+size_t BitVector::find_next(size_t start, uint64_t invert) const {
+    if (start >= length) {
+        return length;
+    }
+    
+    auto index = start / 64;
+    auto word = (words[index] ^ invert) & (~static_cast<uint64_t>(0) >> (start % 64));
+    
+    while (word == 0) {
+        index += 1;
+        if (index >= words.size()) {
+            return length;
+        }
+        word = words[index] ^ invert;
+    }
+    
+    // Padding bits after the end are clear, so they can only be found when looking for clear bits.
+    return std::min(index * 64 + static_cast<size_t>(__builtin_clzll(word)), length);
 }
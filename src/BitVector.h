@@ -31,19 +31,38 @@
  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
+// A sequence of bits, packed most significant bit first into 64 bit words.
 class BitVector {
 public:
     BitVector() : length(0) { }
     
-    std::vector<uint8_t> &data() { return store; }
-    size_t size() { return length; }
-    void push_back(bool value);
+    size_t size() const { return length; }
+    void clear() { words.clear(); length = 0; }
+    void reserve(size_t bits) { words.reserve((bits + 63) / 64); }
+    
+    bool operator[](size_t index) const { return (words[index / 64] >> (63 - index % 64)) & 1; }
+    
+    void push_back(bool value) { append_bits(value ? 1 : 0, 1); }
+    // Append the lowest n bits of value, most significant first. n must be at most 64.
+    void append_bits(uint64_t value, size_t n);
+    void append_byte_msb_first(uint8_t byte) { append_bits(byte, 8); }
+    
+    // Index of the first set or clear bit at or after start, size() if there is none.
+    size_t find_next_set(size_t start) const { return find_next(start, 0); }
+    size_t find_next_clear(size_t start) const { return find_next(start, ~static_cast<uint64_t>(0)); }
+    
+    // Bits packed into bytes, most significant bit first, last byte padded with zeros.
+    std::vector<uint8_t> bytes() const;
     
 private:
-    std::vector<uint8_t> store;
+    std::vector<uint64_t> words;
     size_t length;
+    
+    size_t find_next(size_t start, uint64_t invert) const;
 };
 
 #endif // HAD_BIT_VECTOR_H
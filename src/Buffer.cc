@@ -32,95 +32,49 @@
 
 #include "Exception.h"
 
-Buffer::Buffer(const std::vector<uint8_t> &data_, size_t start, size_t length) : data(data_), start_position(start), end_position(start + length), current_position(start) {
-    if (end_position > data.size()) {
-        throw Exception("buffer overrun");
-    }
-}
-
-
 Buffer Buffer::get_buffer(size_t length) {
-    ensure_bytes(length);
-    auto val = Buffer(data, current_position, length);
-    skip_unchecked(length);
-    return val;
+    return Buffer(get_data(length), length);
 }
 
 
-int8_t Buffer::get_int8() {
-    ensure_bytes(1);
-    int8_t val = data[current_position];
-    skip_unchecked(1);
-    return val;
-}
-
-
-int16_t Buffer::get_int16() {
-    ensure_bytes(2);
-    int16_t val = data[current_position] | (data[current_position + 1] << 8);
-    skip_unchecked(2);
-    return val;
-}
-
-
-int32_t Buffer::get_int32() {
-    ensure_bytes(4);
-    int32_t val = data[current_position] | (data[current_position + 1] << 8) | (data[current_position + 2] << 16) | (data[current_position + 3] << 24);
-    skip_unchecked(4);
-    return val;
-}
-
-
-int64_t Buffer::get_int64() {
-    ensure_bytes(8);
-    int64_t val = data[current_position] | (data[current_position + 1] << 8) | (data[current_position + 2] << 16) | (data[current_position + 3] << 24) | (static_cast<int64_t>(data[current_position + 1]) << 32) | (static_cast<int64_t>(data[current_position + 2]) << 40) | (static_cast<int64_t>(data[current_position + 3]) << 48) | (static_cast<int64_t>(data[current_position + 1]) << 56);
-    skip_unchecked(8);
-    return val;
-}
-
-
-std::string Buffer::get_string(size_t length) {
+const uint8_t *Buffer::get_data(size_t length) {
     ensure_bytes(length);
-    auto val = std::string(data.begin() + current_position, data.begin() + current_position + length);
+    auto val = data + current_position;
     skip_unchecked(length);
     return val;
 }
 
 
-uint8_t Buffer::get_uint8() {
-    ensure_bytes(1);
-    uint8_t val = data[current_position];
-    skip_unchecked(1);
-    return val;
-}
-
-
-uint16_t Buffer::get_uint16() {
-    ensure_bytes(2);
-    uint16_t val = data[current_position] | (data[current_position + 1] << 8);
-    skip_unchecked(2);
-    return val;
+std::string Buffer::get_string(size_t length) {
+    auto val = get_data(length);
+    return std::string(reinterpret_cast<const char *>(val), length);
 }
 
 
-uint32_t Buffer::get_uint32() {
-    ensure_bytes(4);
-    uint32_t val = data[current_position] | (data[current_position + 1] << 8) | (data[current_position + 2] << 16) | (data[current_position + 3] << 24);
-    skip_unchecked(4);
-    return val;
+void Buffer::get_int16_array(size_t n, int16_t *values) {
+    if (n > remaining() / 2) {
+        throw Exception("buffer overrun");
+    }
+    
+    if (host_is_little_endian) {
+        std::memcpy(values, data + current_position, n * 2);
+        skip_unchecked(n * 2);
+    }
+    else {
+        for (size_t i = 0; i < n; i++) {
+            values[i] = static_cast<int16_t>(get_uint16_unchecked());
+        }
+    }
 }
 
 
-uint64_t Buffer::get_uint64() {
-    ensure_bytes(8);
-    uint64_t val = data[current_position] | (data[current_position + 1] << 8) | (data[current_position + 2] << 16) | (data[current_position + 3] << 24) | (static_cast<uint64_t>(data[current_position + 1]) << 32) | (static_cast<uint64_t>(data[current_position + 2]) << 40) | (static_cast<uint64_t>(data[current_position + 3]) << 48) | (static_cast<uint64_t>(data[current_position + 1]) << 56);
-    skip_unchecked(8);
-    return val;
+void Buffer::get_uint8_array(size_t n, uint8_t *values) {
+    std::memcpy(values, get_data(n), n);
 }
 
 
 void Buffer::ensure_bytes(size_t bytes) const {
-    if (current_position + bytes > end_position) {
+    if (bytes > length - current_position) {
         throw Exception("buffer overrun");
     }
 }
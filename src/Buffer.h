@@ -31,39 +31,65 @@
  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstdint>
+#include <cstring>
+#include <string>
 #include <vector>
 
+// Parses little endian data from memory owned by someone else, which must outlive the buffer.
 class Buffer {
 public:
-    Buffer(const std::vector<uint8_t> &data_) : data(data_), start_position(0), end_position(data_.size()), current_position(0) { }
-    Buffer(const std::vector<uint8_t> &data, size_t start, size_t length);
+    Buffer(const std::vector<uint8_t> &data_) : data(data_.data()), length(data_.size()), current_position(0) { }
+    Buffer(const uint8_t *data_, size_t length_) : data(data_), length(length_), current_position(0) { }
 
-    bool at_end() const { return current_position == end_position; }
+    bool at_end() const { return current_position == length; }
+    size_t position() const { return current_position; }
+    size_t remaining() const { return length - current_position; }
     
     Buffer get_buffer(size_t length);
+    const uint8_t *get_data(size_t length);
 
-    int8_t get_int8();
-    int16_t get_int16();
-    int32_t get_int32();
-    int64_t get_int64();
+    int8_t get_int8() { ensure_bytes(1); return static_cast<int8_t>(get_uint8_unchecked()); }
+    int16_t get_int16() { ensure_bytes(2); return static_cast<int16_t>(get_uint16_unchecked()); }
+    int32_t get_int32() { ensure_bytes(4); return static_cast<int32_t>(get_uint32_unchecked()); }
+    int64_t get_int64() { ensure_bytes(8); return static_cast<int64_t>(get_uint64_unchecked()); }
     
     std::string get_string(size_t length);
 
-    uint8_t get_uint8();
-    uint16_t get_uint16();
-    uint32_t get_uint32();
-    uint64_t get_uint64();
+    uint8_t get_uint8() { ensure_bytes(1); return get_uint8_unchecked(); }
+    uint16_t get_uint16() { ensure_bytes(2); return get_uint16_unchecked(); }
+    uint32_t get_uint32() { ensure_bytes(4); return get_uint32_unchecked(); }
+    uint64_t get_uint64() { ensure_bytes(8); return get_uint64_unchecked(); }
+    
+    void get_int16_array(size_t n, int16_t *values);
+    void get_uint8_array(size_t n, uint8_t *values);
     
     void skip(size_t bytes) { ensure_bytes(bytes); skip_unchecked(bytes); }
     
 private:
-    const std::vector<uint8_t> &data;
-    size_t start_position;
-    size_t end_position;
+    const uint8_t *data;
+    size_t length;
     size_t current_position;
     
     void ensure_bytes(size_t bytes) const;
     void skip_unchecked(size_t bytes) { current_position += bytes; }
+    
+    uint8_t get_uint8_unchecked() { return data[current_position++]; }
+    uint16_t get_uint16_unchecked() { uint16_t value; std::memcpy(&value, data + current_position, 2); skip_unchecked(2); return from_little_endian(value); }
+    uint32_t get_uint32_unchecked() { uint32_t value; std::memcpy(&value, data + current_position, 4); skip_unchecked(4); return from_little_endian(value); }
+    uint64_t get_uint64_unchecked() { uint64_t value; std::memcpy(&value, data + current_position, 8); skip_unchecked(8); return from_little_endian(value); }
+    
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    static const bool host_is_little_endian = false;
+    static uint16_t from_little_endian(uint16_t value) { return __builtin_bswap16(value); }
+    static uint32_t from_little_endian(uint32_t value) { return __builtin_bswap32(value); }
+    static uint64_t from_little_endian(uint64_t value) { return __builtin_bswap64(value); }
+#else
+    static const bool host_is_little_endian = true;
+    static uint16_t from_little_endian(uint16_t value) { return value; }
+    static uint32_t from_little_endian(uint32_t value) { return value; }
+    static uint64_t from_little_endian(uint64_t value) { return value; }
+#endif
 };
 
 #endif // HAD_BUFFER_H
@@ -0,0 +1,125 @@
+/*
+ ChannelSplitter.cc -- feed each channel of interleaved audio to its own reader.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ChannelSplitter.h"
+
+#include "Stats.h"
+#include "Trace.h"
+
+const size_t ChannelSplitter::RING_SIZE = 16;
+
+ChannelSplitter::ChannelSplitter(std::unique_ptr<PcmStream> stream_) : stream(std::move(stream_)) {
+    for (size_t channel = 0; channel < stream->sample_format().channels; channel++) {
+        rings.push_back(std::make_unique<Ring<std::vector<int16_t>>>(RING_SIZE));
+    }
+    thread = std::thread(&ChannelSplitter::run, this);
+}
+
+
+ChannelSplitter::~ChannelSplitter() {
+    for (auto &ring : rings) {
+        ring->close();
+    }
+    stream->interrupt();
+    thread.join();
+}
+
+
+std::unique_ptr<SampleSource> ChannelSplitter::source(size_t channel) {
+    return std::make_unique<Channel>(*this, channel);
+}
+
+
+void ChannelSplitter::run() {
+    Trace::name_thread("split channels");
+    auto format = stream->sample_format();
+    auto chunk = std::vector<int16_t>();
+    auto active = std::vector<bool>(rings.size(), true);
+    auto remaining = rings.size();
+    
+    try {
+        while (remaining > 0) {
+            const uint8_t *frames;
+            auto n = stream->read_frames(&frames);
+            if (n == 0) {
+                break;
+            }
+            
+            auto timer = Stats::Timer(Stats::CONVERT);
+            for (size_t channel = 0; channel < rings.size(); channel++) {
+                if (!active[channel]) {
+                    continue;
+                }
+                chunk.resize(n);
+                format.convert(frames, n, channel, chunk.data());
+                if (!rings[channel]->push(chunk)) {
+                    // The reader of this channel is done.
+                    active[channel] = false;
+                    remaining -= 1;
+                }
+            }
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    
+    for (auto &ring : rings) {
+        ring->close();
+    }
+}
+
+
+ChannelSplitter::Channel::Channel(ChannelSplitter &splitter_, size_t channel_) : splitter(splitter_), channel(channel_) {
+    sample_rate = splitter.stream->sample_rate;
+}
+
+
+ChannelSplitter::Channel::~Channel() {
+    splitter.rings[channel]->close();
+}
+
+
+void ChannelSplitter::Channel::interrupt() {
+    splitter.rings[channel]->close();
+}
+
+
+size_t ChannelSplitter::Channel::read(const int16_t **samples) {
+    if (!splitter.rings[channel]->pop(current)) {
+        if (splitter.error) {
+            std::rethrow_exception(splitter.error);
+        }
+        return 0;
+    }
+    
+    *samples = current.data();
+    return current.size();
+}
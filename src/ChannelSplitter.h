@@ -0,0 +1,80 @@
+#ifndef HAD_CHANNEL_SPLITTER_H
+#define HAD_CHANNEL_SPLITTER_H
+
+/*
+ ChannelSplitter.h -- feed each channel of interleaved audio to its own reader.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "PcmStream.h"
+#include "Ring.h"
+#include "SampleSource.h"
+
+// Reads interleaved frames once on its own thread and hands the samples of each channel to a separate source, so recordings captured together can be decoded in parallel.
+class ChannelSplitter {
+public:
+    explicit ChannelSplitter(std::unique_ptr<PcmStream> stream);
+    ChannelSplitter(const ChannelSplitter &other) = delete;
+    ~ChannelSplitter();
+    
+    size_t channels() const { return rings.size(); }
+    
+    // Samples of channel, to be read by one thread. Must not outlive the splitter. Destroying it stops splitting off this channel.
+    std::unique_ptr<SampleSource> source(size_t channel);
+    
+private:
+    class Channel : public SampleSource {
+    public:
+        Channel(ChannelSplitter &splitter_, size_t channel_);
+        ~Channel();
+        
+        size_t read(const int16_t **samples) override;
+        void interrupt() override;
+        
+    private:
+        ChannelSplitter &splitter;
+        size_t channel;
+        std::vector<int16_t> current;
+    };
+    
+    std::unique_ptr<PcmStream> stream;
+    std::vector<std::unique_ptr<Ring<std::vector<int16_t>>>> rings;
+    std::exception_ptr error; // written by the thread before closing the rings
+    std::thread thread;
+    
+    void run();
+    
+    static const size_t RING_SIZE;
+};
+
+#endif // HAD_CHANNEL_SPLITTER_H
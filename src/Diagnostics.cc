@@ -0,0 +1,73 @@
+/*
+ Diagnostics.cc -- collect problems found while processing audio data.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Diagnostics.h"
+
+#include <cinttypes>
+
+std::vector<Diagnostics::Event> Diagnostics::recent() const {
+    auto result = std::vector<Event>();
+    auto first = total > SIZE ? total - SIZE : 0;
+    
+    for (auto i = first; i < total; i++) {
+        result.push_back(events[i % SIZE]);
+    }
+    
+    return result;
+}
+
+
+void Diagnostics::print(FILE *f) const {
+    for (const auto &event : recent()) {
+        fprintf(f, "sample %" PRIu64 ": %s\n", event.position, name(event.type).c_str());
+    }
+    if (total > SIZE) {
+        fprintf(f, "(%" PRIu64 " earlier events not shown)\n", total - SIZE);
+    }
+    for (auto i = 0; i < NUMBER_OF_TYPES; i++) {
+        if (counts[i] > 0) {
+            fprintf(f, "%s: %" PRIu64 "\n", name(static_cast<Type>(i)).c_str(), counts[i]);
+        }
+    }
+}
+
+
+std::string Diagnostics::name(Type type) {
+    switch (type) {
+        case MISSING_POSITIVE_PEAK:
+            return "missing positive peak";
+        case MISSING_NEGATIVE_PEAK:
+            return "missing negative peak";
+        case NUMBER_OF_TYPES:
+            break;
+    }
+    
+    return "invalid";
+}
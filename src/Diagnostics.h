@@ -0,0 +1,78 @@
+#ifndef HAD_DIAGNOSTICS_H
+#define HAD_DIAGNOSTICS_H
+
+/*
+ Diagnostics.h -- collect problems found while processing audio data.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Keeps the most recent events in a fixed size ring and counts all of them. Adding an event does no formatting or I/O.
+class Diagnostics {
+public:
+    enum Type {
+        MISSING_POSITIVE_PEAK,
+        MISSING_NEGATIVE_PEAK,
+        NUMBER_OF_TYPES
+    };
+    
+    class Event {
+    public:
+        Event() : type(NUMBER_OF_TYPES), position(0) { }
+        Event(Type type_, uint64_t position_) : type(type_), position(position_) { }
+        
+        Type type;
+        uint64_t position; // sample offset
+    };
+    
+    Diagnostics() : total(0), counts() { }
+    
+    void add(Type type, uint64_t position) { events[total % SIZE] = Event(type, position); total += 1; counts[type] += 1; }
+    
+    uint64_t count() const { return total; }
+    uint64_t count(Type type) const { return counts[type]; }
+    std::vector<Event> recent() const;
+    
+    void print(FILE *f) const;
+    
+    static std::string name(Type type);
+    
+    static const size_t SIZE = 256;
+
+private:
+    std::array<Event, SIZE> events;
+    uint64_t total;
+    std::array<uint64_t, NUMBER_OF_TYPES> counts;
+};
+
+#endif // HAD_DIAGNOSTICS_H
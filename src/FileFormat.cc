@@ -34,13 +34,16 @@
 #include <filesystem>
 
 #include "Exception.h"
+#include "utility.h"
 
 std::unordered_map<std::string, FileFormat::Type> FileFormat::extensions = {
+    { "flac", FLAC },
     { "tzx", TZX },
     { "wav", WAV }
 };
 
 std::unordered_map<std::string, FileFormat::Type> FileFormat::names = {
+    { "flac", FLAC },
     { "raw", RAW },
     { "raw data", RAW },
     { "tzx", TZX },
@@ -49,14 +52,19 @@ std::unordered_map<std::string, FileFormat::Type> FileFormat::names = {
 };
 
 std::vector<FileFormat::Signature> FileFormat::signatures = {
+    Signature(0, "fLaC", FLAC),
     Signature(0, "TI-TAPE", TI_TAPE),
     Signature(0, "RIFF", WAV),
+    Signature(0, "RF64", WAV),
+    Signature(0, "BW64", WAV),
     Signature(0, "ZXTape!\x1a", TZX)
 };
 
 
 std::string FileFormat::name(Type type) {
     switch (type) {
+        case FLAC:
+            return "FLAC";
         case RAW:
             return "raw data";
         case TI_TAPE:
@@ -72,9 +80,9 @@ std::string FileFormat::name(Type type) {
     return "invalid";
 }
 
-FileFormat::Type FileFormat::by_contents(const std::vector<uint8_t> &data, System::Type system) {
+FileFormat::Type FileFormat::by_contents(const uint8_t *data, size_t length, System::Type system) {
     for (const auto &signature : signatures) {
-        if (signature.matches(data)) {
+        if (signature.matches(data, length)) {
             return signature.type;
         }
     }
@@ -82,6 +90,36 @@ FileFormat::Type FileFormat::by_contents(const std::vector<uint8_t> &data, Syste
 }
 
 
+FileFormat::Type FileFormat::by_file(const std::string &filename, System::Type) {
+    size_t prefix_length = 0;
+    for (const auto &signature : signatures) {
+        if (signature.offset >= 0) {
+            prefix_length = std::max(prefix_length, static_cast<size_t>(signature.offset) + signature.value.size());
+        }
+    }
+    auto prefix = get_file_part(filename, 0, prefix_length);
+    
+    for (const auto &signature : signatures) {
+        if (signature.offset >= 0) {
+            if (signature.matches(prefix.data(), prefix.size())) {
+                return signature.type;
+            }
+        }
+        else {
+            auto size = std::filesystem::file_size(filename);
+            auto length = static_cast<uint64_t>(-signature.offset);
+            if (length <= size) {
+                auto suffix = get_file_part(filename, size - length, length);
+                if (signature.matches(suffix.data(), suffix.size())) {
+                    return signature.type;
+                }
+            }
+        }
+    }
+    return RAW;
+}
+
+
 FileFormat::Type FileFormat::by_filename(const std::string &filename) {
     auto extension = std::filesystem::path(filename).extension().string();
     if (extension.empty()) {
@@ -123,22 +161,22 @@ FileFormat::Signature::Signature(int64_t offset_, const std::string &value_, Typ
 }
 
 
-bool FileFormat::Signature::matches(const std::vector<uint8_t> &data) const {
+bool FileFormat::Signature::matches(const uint8_t *data, size_t length) const {
     uint64_t start;
     
     if (offset >= 0) {
         start = static_cast<uint64_t>(offset);
     }
     else {
-        if (-offset > data.size()) {
+        if (static_cast<uint64_t>(-offset) > length) {
             return false;
         }
-        start = data.size() - offset;
+        start = length + offset;
     }
     
-    if (start + value.size() > data.size()) {
+    if (start + value.size() > length) {
         return false;
     }
     
-    return std::equal(value.begin(), value.end(), data.begin() + start);
+    return std::equal(value.begin(), value.end(), data + start);
 }
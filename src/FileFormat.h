@@ -31,6 +31,7 @@
  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -40,6 +41,7 @@
 class FileFormat {
 public:
     enum Type {
+        FLAC,
         TI_TAPE,
         TZX,
         RAW,
@@ -48,7 +50,10 @@ public:
     };
     
     static std::string name(Type type);
-    static Type by_contents(const std::vector<uint8_t> &data, System::Type system);
+    static Type by_contents(const std::vector<uint8_t> &data, System::Type system) { return by_contents(data.data(), data.size(), system); }
+    static Type by_contents(const uint8_t *data, size_t length, System::Type system);
+    // Like by_contents, but only reads the parts of the file the signatures look at.
+    static Type by_file(const std::string &filename, System::Type system);
     static Type by_extension(const std::string &extension);
     static Type by_filename(const std::string &filename);
     static Type by_name(const std::string &name);
@@ -63,7 +68,7 @@ private:
         std::vector<uint8_t> value;
         Type type;
         
-        bool matches(const std::vector<uint8_t> &data) const;
+        bool matches(const uint8_t *data, size_t length) const;
     };
 
     static std::unordered_map<std::string, Type> extensions;
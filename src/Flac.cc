@@ -0,0 +1,570 @@
+/*
+ Flac.cc -- decode FLAC files.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Flac.h"
+
+#include <algorithm>
+#include <array>
+#include <string>
+
+#include "Exception.h"
+#include "Stats.h"
+#include "Trace.h"
+
+const uint32_t Flac::MAX_CHANNELS = 8;
+
+Flac::Flac(const uint8_t *data_, size_t length_, Mixdown mixdown_) : channels(0), bits_per_sample(0), total_samples(0), data(data_), length(length_), position(0), mixdown(mixdown_) {
+    if (length < 4 || std::string(reinterpret_cast<const char *>(data), 4) != "fLaC") {
+        throw Exception("not a FLAC file");
+    }
+    position = 4;
+    
+    parse_metadata();
+    
+    if (channels == 1) {
+        mixdown = LEFT;
+    }
+    channel_samples.resize(channels);
+}
+
+
+size_t Flac::read(const int16_t **samples) {
+    auto timer = Stats::Timer(Stats::CONVERT);
+    
+    if (!find_frame()) {
+        return 0;
+    }
+    
+    decode_frame();
+    
+    *samples = output.data();
+    return output.size();
+}
+
+
+void Flac::parse_metadata() {
+    auto have_stream_info = false;
+    auto last = false;
+    
+    while (!last) {
+        if (length - position < 4) {
+            throw Exception("truncated FLAC metadata");
+        }
+        last = (data[position] & 0x80) != 0;
+        auto type = data[position] & 0x7f;
+        size_t block_length = (data[position + 1] << 16) | (data[position + 2] << 8) | data[position + 3];
+        position += 4;
+        if (length - position < block_length) {
+            throw Exception("truncated FLAC metadata");
+        }
+        
+        if (type == 0) {
+            if (block_length < 34) {
+                throw Exception("invalid FLAC stream info");
+            }
+            auto reader = BitReader(data + position, block_length);
+            reader.read(16); // minimum block size
+            reader.read(16); // maximum block size
+            reader.read(24); // minimum frame size
+            reader.read(24); // maximum frame size
+            sample_rate = static_cast<int>(reader.read(20));
+            channels = reader.read(3) + 1;
+            bits_per_sample = reader.read(5) + 1;
+            total_samples = (static_cast<uint64_t>(reader.read(4)) << 32) | reader.read(32);
+            have_stream_info = true;
+        }
+        
+        position += block_length;
+    }
+    
+    if (!have_stream_info) {
+        throw Exception("missing FLAC stream info");
+    }
+    if (sample_rate == 0) {
+        throw Exception("invalid sample rate");
+    }
+    if (bits_per_sample < 4) {
+        throw Exception("unsupported sample size");
+    }
+}
+
+
+bool Flac::find_frame() {
+    // Frames start with a 14 bit sync code, which can also occur in audio data. A frame header is only accepted if its CRC matches.
+    while (length - position >= 2) {
+        if (data[position] != 0xff || (data[position + 1] & 0xfe) != 0xf8) {
+            position++;
+            continue;
+        }
+        
+        // Longest header: 4 fixed bytes, 7 bytes coded number, 2 bytes block size, 2 bytes sample rate, CRC.
+        auto header_length = std::min(length - position, static_cast<size_t>(16));
+        auto reader = BitReader(data + position, header_length);
+        try {
+            reader.read(16); // sync and blocking strategy
+            auto block_size_code = reader.read(4);
+            auto sample_rate_code = reader.read(4);
+            reader.read(8); // channel assignment, sample size, reserved
+            auto first = reader.read(8);
+            auto extra = 0;
+            while (extra < 7 && (first & (0x40 >> extra)) && (first & 0x80)) {
+                extra++;
+            }
+            for (auto i = 0; i < extra; i++) {
+                reader.read(8);
+            }
+            if (block_size_code == 6) {
+                reader.read(8);
+            }
+            else if (block_size_code == 7) {
+                reader.read(16);
+            }
+            if (sample_rate_code == 12) {
+                reader.read(8);
+            }
+            else if (sample_rate_code == 13 || sample_rate_code == 14) {
+                reader.read(16);
+            }
+            auto crc_position = reader.byte_position();
+            if (reader.read(8) == crc8(data + position, crc_position)) {
+                return true;
+            }
+        }
+        catch (Exception &) { }
+        
+        position++;
+    }
+    
+    position = length;
+    return false;
+}
+
+
+void Flac::decode_frame() {
+    auto span = Trace::Span("decode FLAC frame");
+    auto reader = BitReader(data + position, length - position);
+    
+    reader.read(16); // sync and blocking strategy, checked in find_frame
+    auto block_size_code = reader.read(4);
+    auto sample_rate_code = reader.read(4);
+    auto channel_assignment = reader.read(4);
+    auto sample_size_code = reader.read(3);
+    reader.read(1);
+    
+    auto first = reader.read(8);
+    for (auto mask = 0x40; (first & 0x80) && (first & mask); mask >>= 1) {
+        reader.read(8);
+    }
+    
+    uint32_t block_size;
+    switch (block_size_code) {
+        case 0:
+            throw Exception("invalid FLAC block size");
+        case 1:
+            block_size = 192;
+            break;
+        case 6:
+            block_size = reader.read(8) + 1;
+            break;
+        case 7:
+            block_size = reader.read(16) + 1;
+            break;
+        default:
+            if (block_size_code < 6) {
+                block_size = 576 << (block_size_code - 2);
+            }
+            else {
+                block_size = 256 << (block_size_code - 8);
+            }
+            break;
+    }
+    
+    if (sample_rate_code == 12) {
+        reader.read(8);
+    }
+    else if (sample_rate_code == 13 || sample_rate_code == 14) {
+        reader.read(16);
+    }
+    
+    uint32_t sample_size;
+    switch (sample_size_code) {
+        case 0:
+            sample_size = bits_per_sample;
+            break;
+        case 1:
+            sample_size = 8;
+            break;
+        case 2:
+            sample_size = 12;
+            break;
+        case 4:
+            sample_size = 16;
+            break;
+        case 5:
+            sample_size = 20;
+            break;
+        case 6:
+            sample_size = 24;
+            break;
+        case 7:
+            sample_size = 32;
+            break;
+        default:
+            throw Exception("invalid FLAC sample size");
+    }
+    if (sample_size != bits_per_sample) {
+        throw Exception("FLAC sample size changes between frames");
+    }
+    
+    uint32_t frame_channels = channel_assignment < 8 ? channel_assignment + 1 : 2;
+    if (channel_assignment > 10) {
+        throw Exception("invalid FLAC channel assignment");
+    }
+    if (frame_channels != channels) {
+        throw Exception("FLAC channel count changes between frames");
+    }
+    
+    reader.read(8); // CRC-8, checked in find_frame
+
+    for (uint32_t channel = 0; channel < channels; channel++) {
+        auto channel_sample_size = sample_size;
+        // The side channel needs one more bit.
+        if ((channel_assignment == 8 && channel == 1) || (channel_assignment == 9 && channel == 0) || (channel_assignment == 10 && channel == 1)) {
+            channel_sample_size += 1;
+        }
+        channel_samples[channel].resize(block_size);
+        decode_subframe(reader, block_size, channel_sample_size, channel_samples[channel].data());
+    }
+    
+    reader.align();
+    auto crc_position = reader.byte_position();
+    if (reader.read(16) != crc16(data + position, crc_position)) {
+        throw Exception("FLAC frame CRC error");
+    }
+    position += reader.byte_position();
+    
+    if (channel_assignment >= 8) {
+        auto left = channel_samples[0].data();
+        auto right = channel_samples[1].data();
+        
+        for (uint32_t i = 0; i < block_size; i++) {
+            switch (channel_assignment) {
+                case 8: // left, side
+                    right[i] = left[i] - right[i];
+                    break;
+                    
+                case 9: // side, right
+                    left[i] = left[i] + right[i];
+                    break;
+                    
+                case 10: { // mid, side
+                    auto side = right[i];
+                    auto mid = static_cast<int64_t>(static_cast<uint64_t>(left[i]) << 1) | (side & 1);
+                    left[i] = (mid + side) >> 1;
+                    right[i] = (mid - side) >> 1;
+                    break;
+                }
+            }
+        }
+    }
+    
+    output.resize(block_size);
+    switch (mixdown) {
+        case LEFT:
+        case RIGHT: {
+            const auto &channel = channel_samples[mixdown == LEFT ? 0 : 1];
+            for (uint32_t i = 0; i < block_size; i++) {
+                output[i] = to_sample(channel[i]);
+            }
+            break;
+        }
+            
+        case BOTH:
+            for (uint32_t i = 0; i < block_size; i++) {
+                output[i] = static_cast<int16_t>((to_sample(channel_samples[0][i]) + to_sample(channel_samples[1][i])) / 2);
+            }
+            break;
+    }
+}
+
+
+void Flac::decode_subframe(BitReader &reader, uint32_t block_size, uint32_t sample_size, int64_t *samples) {
+    if (reader.read(1) != 0) {
+        throw Exception("invalid FLAC subframe");
+    }
+    auto type = reader.read(6);
+    uint32_t wasted_bits = 0;
+    if (reader.read(1)) {
+        wasted_bits = reader.read_unary() + 1;
+        if (wasted_bits >= sample_size) {
+            throw Exception("invalid FLAC wasted bits");
+        }
+        sample_size -= wasted_bits;
+    }
+    if (sample_size > 32) {
+        throw Exception("unsupported FLAC sample size");
+    }
+    
+    if (type == 0) { // constant
+        auto value = reader.read_signed(sample_size);
+        for (uint32_t i = 0; i < block_size; i++) {
+            samples[i] = value;
+        }
+    }
+    else if (type == 1) { // verbatim
+        for (uint32_t i = 0; i < block_size; i++) {
+            samples[i] = reader.read_signed(sample_size);
+        }
+    }
+    else if (type >= 8 && type <= 12) { // fixed predictor
+        auto order = type - 8;
+        if (order > block_size) {
+            throw Exception("invalid FLAC predictor order");
+        }
+        for (uint32_t i = 0; i < order; i++) {
+            samples[i] = reader.read_signed(sample_size);
+        }
+        decode_residual(reader, block_size, order, samples);
+        
+        switch (order) {
+            case 1:
+                for (uint32_t i = 1; i < block_size; i++) {
+                    samples[i] += samples[i - 1];
+                }
+                break;
+            case 2:
+                for (uint32_t i = 2; i < block_size; i++) {
+                    samples[i] += 2 * samples[i - 1] - samples[i - 2];
+                }
+                break;
+            case 3:
+                for (uint32_t i = 3; i < block_size; i++) {
+                    samples[i] += 3 * samples[i - 1] - 3 * samples[i - 2] + samples[i - 3];
+                }
+                break;
+            case 4:
+                for (uint32_t i = 4; i < block_size; i++) {
+                    samples[i] += 4 * samples[i - 1] - 6 * samples[i - 2] + 4 * samples[i - 3] - samples[i - 4];
+                }
+                break;
+        }
+    }
+    else if (type >= 32) { // linear prediction
+        auto order = type - 31;
+        if (order > block_size) {
+            throw Exception("invalid FLAC predictor order");
+        }
+        for (uint32_t i = 0; i < order; i++) {
+            samples[i] = reader.read_signed(sample_size);
+        }
+        auto precision = reader.read(4) + 1;
+        if (precision == 16) {
+            throw Exception("invalid FLAC coefficient precision");
+        }
+        auto shift = reader.read_signed(5);
+        if (shift < 0) {
+            throw Exception("invalid FLAC prediction shift");
+        }
+        std::array<int64_t, 32> coefficients;
+        for (uint32_t i = 0; i < order; i++) {
+            coefficients[i] = reader.read_signed(precision);
+        }
+        decode_residual(reader, block_size, order, samples);
+        
+        for (uint32_t i = order; i < block_size; i++) {
+            int64_t prediction = 0;
+            for (uint32_t j = 0; j < order; j++) {
+                prediction += coefficients[j] * samples[i - 1 - j];
+            }
+            samples[i] += prediction >> shift;
+        }
+    }
+    else {
+        throw Exception("invalid FLAC subframe type");
+    }
+    
+    if (wasted_bits > 0) {
+        for (uint32_t i = 0; i < block_size; i++) {
+            samples[i] = static_cast<int64_t>(static_cast<uint64_t>(samples[i]) << wasted_bits);
+        }
+    }
+}
+
+
+void Flac::decode_residual(BitReader &reader, uint32_t block_size, uint32_t order, int64_t *samples) {
+    auto method = reader.read(2);
+    if (method > 1) {
+        throw Exception("invalid FLAC residual coding method");
+    }
+    auto parameter_bits = method == 0 ? 4 : 5;
+    auto escape = method == 0 ? 15u : 31u;
+    auto partition_order = reader.read(4);
+    uint32_t partition_size = block_size >> partition_order;
+    
+    if ((partition_size << partition_order) != block_size || partition_size < order) {
+        throw Exception("invalid FLAC partition order");
+    }
+    
+    auto out = samples + order;
+    for (uint32_t partition = 0; partition < (1u << partition_order); partition++) {
+        auto n = partition == 0 ? partition_size - order : partition_size;
+        auto parameter = reader.read(parameter_bits);
+        
+        if (parameter == escape) {
+            auto bits = reader.read(5);
+            for (uint32_t i = 0; i < n; i++) {
+                *(out++) = reader.read_signed(bits);
+            }
+        }
+        else {
+            for (uint32_t i = 0; i < n; i++) {
+                uint64_t value = (static_cast<uint64_t>(reader.read_unary()) << parameter) | reader.read(parameter);
+                *(out++) = static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+            }
+        }
+    }
+}
+
+
+int16_t Flac::to_sample(int64_t value) const {
+    if (bits_per_sample > 16) {
+        return static_cast<int16_t>(value >> (bits_per_sample - 16));
+    }
+    else {
+        return static_cast<int16_t>(value * (1 << (16 - bits_per_sample)));
+    }
+}
+
+
+uint8_t Flac::crc8(const uint8_t *data, size_t length) {
+    static const auto table = [] {
+        std::array<uint8_t, 256> table{};
+        for (auto i = 0; i < 256; i++) {
+            uint8_t crc = static_cast<uint8_t>(i);
+            for (auto bit = 0; bit < 8; bit++) {
+                crc = static_cast<uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[crc ^ data[i]];
+    }
+    return crc;
+}
+
+
+uint16_t Flac::crc16(const uint8_t *data, size_t length) {
+    static const auto table = [] {
+        std::array<uint16_t, 256> table{};
+        for (auto i = 0; i < 256; i++) {
+            uint16_t crc = static_cast<uint16_t>(i << 8);
+            for (auto bit = 0; bit < 8; bit++) {
+                crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }();
+    
+    uint16_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        crc = static_cast<uint16_t>((crc << 8) ^ table[(crc >> 8) ^ data[i]]);
+    }
+    return crc;
+}
+
+
+uint32_t Flac::BitReader::read(unsigned int n) {
+    if (n == 0) {
+        return 0;
+    }
+    if (cache_bits < n) {
+        refill();
+        if (cache_bits < n) {
+            throw Exception("unexpected end of FLAC data");
+        }
+    }
+    
+    auto value = static_cast<uint32_t>(cache >> (64 - n));
+    skip(n);
+    return value;
+}
+
+
+int64_t Flac::BitReader::read_signed(unsigned int n) {
+    if (n == 0) {
+        return 0;
+    }
+    
+    uint64_t value;
+    if (n > 32) {
+        value = static_cast<uint64_t>(read(n - 32)) << 32;
+        value |= read(32);
+    }
+    else {
+        value = read(n);
+    }
+    
+    return static_cast<int64_t>(value << (64 - n)) >> (64 - n);
+}
+
+
+uint32_t Flac::BitReader::read_unary() {
+    uint32_t count = 0;
+    
+    while (true) {
+        if (cache == 0) {
+            count += cache_bits;
+            cache_bits = 0;
+            refill();
+            if (cache_bits == 0) {
+                throw Exception("unexpected end of FLAC data");
+            }
+            continue;
+        }
+        
+        auto zeros = static_cast<unsigned int>(__builtin_clzll(cache));
+        skip(zeros + 1);
+        return count + zeros;
+    }
+}
+
+
+void Flac::BitReader::refill() {
+    while (cache_bits <= 56 && position < length) {
+        cache |= static_cast<uint64_t>(data[position]) << (56 - cache_bits);
+        position++;
+        cache_bits += 8;
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef HAD_FLAC_H
+#define HAD_FLAC_H
+
+/*
+ Flac.h -- decode FLAC files.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "SampleSource.h"
+
+// Decodes a native FLAC stream one frame at a time, as the samples are read.
+class Flac : public SampleSource {
+public:
+    Flac(const uint8_t *data, size_t length, Mixdown mixdown);
+    
+    size_t read(const int16_t **samples) override;
+
+    uint32_t channels;
+    uint32_t bits_per_sample;
+    uint64_t total_samples; // 0 if unknown
+    
+private:
+    class BitReader {
+    public:
+        BitReader(const uint8_t *data_, size_t length_) : data(data_), length(length_), position(0), cache(0), cache_bits(0) { }
+        
+        uint32_t read(unsigned int n);
+        int64_t read_signed(unsigned int n);
+        uint32_t read_unary();
+        void align() { skip(cache_bits % 8); }
+        size_t byte_position() const { return position - cache_bits / 8; }
+        
+    private:
+        const uint8_t *data;
+        size_t length;
+        size_t position;
+        uint64_t cache; // most significant bit is next
+        unsigned int cache_bits;
+        
+        void refill();
+        void skip(unsigned int n) { cache = n < 64 ? cache << n : 0; cache_bits -= n; }
+    };
+    
+    const uint8_t *data;
+    size_t length;
+    size_t position;
+    Mixdown mixdown;
+    
+    std::vector<std::vector<int64_t>> channel_samples;
+    std::vector<int16_t> output;
+    
+    void parse_metadata();
+    bool find_frame();
+    void decode_frame();
+    void decode_subframe(BitReader &reader, uint32_t block_size, uint32_t sample_size, int64_t *samples);
+    void decode_residual(BitReader &reader, uint32_t block_size, uint32_t order, int64_t *samples);
+    int16_t to_sample(int64_t value) const;
+
+    static uint8_t crc8(const uint8_t *data, size_t length);
+    static uint16_t crc16(const uint8_t *data, size_t length);
+    
+    static const uint32_t MAX_CHANNELS;
+};
+
+#endif // HAD_FLAC_H
@@ -0,0 +1,86 @@
+/*
+ InputIdentity.cc -- identify the recording saved state belongs to.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "InputIdentity.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "utility.h"
+
+const size_t InputIdentity::WINDOW_LENGTH = 4096;
+const size_t InputIdentity::NUMBER_OF_WINDOWS = 16;
+
+InputIdentity::InputIdentity(const std::string &filename, uint64_t data_offset_) : data_offset(data_offset_) {
+    size = std::filesystem::file_size(filename);
+    hash = compute_hash(filename, data_offset, size);
+}
+
+
+InputIdentity InputIdentity::read(Buffer &buffer) {
+    auto identity = InputIdentity();
+    
+    identity.size = buffer.get_uint64();
+    identity.data_offset = buffer.get_uint64();
+    identity.hash = buffer.get_uint64();
+    
+    return identity;
+}
+
+
+void InputIdentity::write(OutputFile &file) const {
+    file.write_64(size);
+    file.write_64(data_offset);
+    file.write_64(hash);
+}
+
+
+bool InputIdentity::matches(const std::string &filename, uint64_t data_offset_) const {
+    std::error_code error;
+    auto current_size = std::filesystem::file_size(filename, error);
+    
+    // Data appended since doesn't matter.
+    return !error && data_offset == data_offset_ && current_size >= size && compute_hash(filename, data_offset, size) == hash;
+}
+
+
+// Hash windows spread evenly over the sample data before size, from the start to the end. They don't change when more is appended.
+uint64_t InputIdentity::compute_hash(const std::string &filename, uint64_t data_offset, uint64_t size) {
+    auto length = size > data_offset ? size - data_offset : 0;
+    auto window_length = static_cast<size_t>(std::min(length, static_cast<uint64_t>(WINDOW_LENGTH)));
+    uint64_t hash = 0;
+    
+    for (size_t i = 0; i < NUMBER_OF_WINDOWS; i++) {
+        auto window = get_file_part(filename, data_offset + (length - window_length) * i / (NUMBER_OF_WINDOWS - 1), window_length);
+        hash = hash_data(window.data(), window.size(), hash);
+    }
+    
+    return hash;
+}
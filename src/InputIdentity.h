@@ -0,0 +1,63 @@
+#ifndef HAD_INPUT_IDENTITY_H
+#define HAD_INPUT_IDENTITY_H
+
+/*
+ InputIdentity.h -- identify the recording saved state belongs to.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdint>
+#include <string>
+
+#include "Buffer.h"
+#include "OutputFile.h"
+
+// Identifies a recording, so state saved while decoding it isn't used with another one. Recordings may still be growing, so only the part present when the identity was taken is compared.
+class InputIdentity {
+public:
+    InputIdentity() : size(0), data_offset(0), hash(0) { }
+    InputIdentity(const std::string &filename, uint64_t data_offset);
+    
+    static InputIdentity read(Buffer &buffer);
+    void write(OutputFile &file) const;
+    
+    bool empty() const { return size == 0; }
+    bool matches(const std::string &filename, uint64_t data_offset) const;
+    
+    uint64_t size;
+    uint64_t data_offset; // position of the first sample
+    uint64_t hash; // of parts of the sample data
+    
+private:
+    static uint64_t compute_hash(const std::string &filename, uint64_t data_offset, uint64_t size);
+    
+    static const size_t WINDOW_LENGTH;
+    static const size_t NUMBER_OF_WINDOWS;
+};
+
+#endif // HAD_INPUT_IDENTITY_H
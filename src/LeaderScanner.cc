@@ -0,0 +1,174 @@
+/*
+ LeaderScanner.cc -- find sync leaders by their tone.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "LeaderScanner.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Stats.h"
+
+const float LeaderScanner::bin_factors[] = { 0.85f, 0.95f, 1.05f, 1.15f };
+const float LeaderScanner::THRESHOLD = 0.4f; // share of energy in the strongest bin
+const double LeaderScanner::WINDOW_DURATION = 0.005; // seconds, short enough to see the data mark after a block sync
+const double LeaderScanner::MINIMUM_DURATION = 3; // seconds, the leader is nominally 4.5 seconds long
+
+LeaderScanner::LeaderScanner(int sample_rate, double frequency) : energy(0), window_fill(0), window_start(0), decimation_sum(0), decimation_fill(0), in_leader(false), leader_start(0) {
+    // Keep about 16 samples per period of the tone.
+    decimation = std::max(static_cast<size_t>(1), static_cast<size_t>(sample_rate / (frequency * 16)));
+    auto decimated_rate = static_cast<double>(sample_rate) / static_cast<double>(decimation);
+    window_length = std::max(static_cast<size_t>(8), static_cast<size_t>(decimated_rate * WINDOW_DURATION));
+    minimum_length = static_cast<uint64_t>(sample_rate * MINIMUM_DURATION);
+    
+    for (size_t i = 0; i < NUMBER_OF_BINS; i++) {
+        coefficients[i] = static_cast<float>(2 * cos(2 * M_PI * frequency * bin_factors[i] / decimated_rate));
+        s1[i] = 0;
+        s2[i] = 0;
+    }
+}
+
+
+void LeaderScanner::add(const int16_t *samples, size_t n) {
+    auto timer = Stats::Timer(Stats::SCAN);
+    auto scale = 1.0f / static_cast<float>(decimation * 32768);
+    size_t i = 0;
+    
+    decimated.clear();
+    while (i < n) {
+        if (decimation_fill == 0 && n - i >= decimation) {
+            // Whole groups of samples, kept apart from the general case so the compiler can vectorize them.
+            auto groups = (n - i) / decimation;
+            for (size_t group = 0; group < groups; group++) {
+                auto sum = 0;
+                for (size_t j = 0; j < decimation; j++) {
+                    sum += samples[i + j];
+                }
+                decimated.push_back(static_cast<float>(sum) * scale);
+                i += decimation;
+            }
+        }
+        else {
+            decimation_sum += samples[i++];
+            if (++decimation_fill == decimation) {
+                decimated.push_back(static_cast<float>(decimation_sum) * scale);
+                decimation_sum = 0;
+                decimation_fill = 0;
+            }
+        }
+    }
+    
+    filter(decimated.data(), decimated.size());
+}
+
+
+// Run the Goertzel filters over decimated samples, ending windows as they fill up.
+void LeaderScanner::filter(const float *values, size_t n) {
+    size_t i = 0;
+    
+    while (i < n) {
+        auto end = i + std::min(n - i, window_length - window_fill);
+        auto window_energy = energy;
+        
+#ifdef __SSE2__
+        // All bins are updated at once.
+        auto coefficient = _mm_loadu_ps(coefficients);
+        auto previous = _mm_loadu_ps(s1);
+        auto before = _mm_loadu_ps(s2);
+        for (auto j = i; j < end; j++) {
+            window_energy += values[j] * values[j];
+            auto current = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(values[j]), _mm_mul_ps(coefficient, previous)), before);
+            before = previous;
+            previous = current;
+        }
+        _mm_storeu_ps(s1, previous);
+        _mm_storeu_ps(s2, before);
+#else
+        for (auto j = i; j < end; j++) {
+            window_energy += values[j] * values[j];
+            for (size_t k = 0; k < NUMBER_OF_BINS; k++) {
+                auto current = values[j] + coefficients[k] * s1[k] - s2[k];
+                s2[k] = s1[k];
+                s1[k] = current;
+            }
+        }
+#endif
+        
+        energy = window_energy;
+        window_fill += end - i;
+        i = end;
+        if (window_fill == window_length) {
+            end_window();
+        }
+    }
+}
+
+
+void LeaderScanner::finish() {
+    if (in_leader) {
+        end_leader(window_start);
+    }
+}
+
+
+void LeaderScanner::end_window() {
+    // The power in a bin is at most energy * window_length / 2, reached for a sine wave of the bin's frequency.
+    auto strongest = 0.0f;
+    for (size_t k = 0; k < NUMBER_OF_BINS; k++) {
+        strongest = std::max(strongest, s1[k] * s1[k] + s2[k] * s2[k] - coefficients[k] * s1[k] * s2[k]);
+        s1[k] = 0;
+        s2[k] = 0;
+    }
+    auto is_tone = energy > 0 && strongest > THRESHOLD * energy * static_cast<float>(window_length) / 2;
+    
+    if (is_tone && !in_leader) {
+        in_leader = true;
+        leader_start = window_start;
+    }
+    
+    energy = 0;
+    window_fill = 0;
+    window_start += window_length * decimation;
+    
+    if (!is_tone && in_leader) {
+        end_leader(window_start - window_length * decimation);
+    }
+}
+
+
+void LeaderScanner::end_leader(uint64_t end) {
+    in_leader = false;
+    if (end - leader_start >= minimum_length) {
+        leaders.emplace_back(leader_start, end);
+    }
+}
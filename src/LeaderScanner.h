@@ -0,0 +1,89 @@
+#ifndef HAD_LEADER_SCANNER_H
+#define HAD_LEADER_SCANNER_H
+
+/*
+ LeaderScanner.h -- find sync leaders by their tone.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Finds sync leaders in audio data by the share of energy near the frequency of a run of zero bits, without detecting pulses. The samples are decimated and split into short windows, and each window is run through Goertzel filters for a few frequencies around the nominal one, to allow for tape speed variations.
+class LeaderScanner {
+public:
+    class Leader {
+    public:
+        Leader(uint64_t start_, uint64_t end_) : start(start_), end(end_) { }
+        
+        uint64_t start; // first sample of tone
+        uint64_t end; // first sample after tone
+    };
+    
+    // frequency is the nominal frequency of the leader tone in Hz.
+    LeaderScanner(int sample_rate, double frequency);
+    
+    void add(const int16_t *samples, size_t n);
+    // Call after the last samples have been added.
+    void finish();
+    
+    std::vector<Leader> leaders;
+    uint64_t minimum_length; // in samples, shorter runs of tone (like the syncs of blocks) are ignored
+    
+    static const size_t NUMBER_OF_BINS = 4;
+    
+private:
+    size_t decimation;
+    size_t window_length; // in decimated samples
+    float coefficients[NUMBER_OF_BINS];
+    
+    // State of the current window.
+    float s1[NUMBER_OF_BINS];
+    float s2[NUMBER_OF_BINS];
+    float energy;
+    size_t window_fill;
+    uint64_t window_start;
+    int32_t decimation_sum;
+    size_t decimation_fill;
+    std::vector<float> decimated;
+    
+    bool in_leader;
+    uint64_t leader_start;
+    
+    void filter(const float *values, size_t n);
+    void end_window();
+    void end_leader(uint64_t end);
+    
+    static const float bin_factors[NUMBER_OF_BINS];
+    static const float THRESHOLD;
+    static const double WINDOW_DURATION;
+    static const double MINIMUM_DURATION;
+};
+
+#endif // HAD_LEADER_SCANNER_H
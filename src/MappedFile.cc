@@ -0,0 +1,82 @@
+/*
+ MappedFile.cc -- read-only view of a file mapped into memory.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Exception.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "utility.h"
+
+MappedFile::MappedFile(const std::string &filename) : mapping(nullptr), length(0) {
+    auto timer = Stats::Timer(Stats::READ);
+    auto span = Trace::Span("map file");
+
+    auto fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw Exception("can't open '" + filename + "': " + strerror(errno));
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        auto error = errno;
+        close(fd);
+        throw Exception("can't stat '" + filename + "': " + strerror(error));
+    }
+    
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        length = static_cast<size_t>(st.st_size);
+        auto address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED) {
+            mapping = static_cast<uint8_t *>(address);
+            madvise(address, length, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+    
+    if (mapping == nullptr) {
+        contents = get_file_contents(filename);
+        length = contents.size();
+    }
+}
+
+
+MappedFile::~MappedFile() {
+    if (mapping != nullptr) {
+        munmap(mapping, length);
+    }
+}
@@ -41,9 +41,32 @@ OutputFile::OutputFile(const std::string &filename) {
 }
 
 OutputFile::~OutputFile() {
-    fclose(f);
+    if (f) {
+        fclose(f);
+    }
+}
+
+
+void OutputFile::write_string(const std::string &string) {
+    if (f) {
+        fputs(string.c_str(), f);
+    }
+    else {
+        buffer.insert(buffer.end(), string.begin(), string.end());
+    }
 }
 
+
+void OutputFile::write_data(const std::vector<uint8_t> &data) {
+    if (f) {
+        fwrite(data.data(), 1, data.size(), f);
+    }
+    else {
+        buffer.insert(buffer.end(), data.begin(), data.end());
+    }
+}
+
+
 void OutputFile::write_16(uint16_t value) {
     write_8(value & 0xff);
     write_8(value >> 8);
@@ -63,3 +86,9 @@ void OutputFile::write_32(uint32_t value) {
     write_8((value >> 16) & 0xff);
     write_8(value >> 24);
 }
+
+
+void OutputFile::write_64(uint64_t value) {
+    write_32(value & 0xffffffff);
+    write_32(value >> 32);
+}
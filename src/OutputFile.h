@@ -31,6 +31,7 @@
  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstdint>
 #include <cstdio>
 #include <string>
 #include <vector>
@@ -38,17 +39,25 @@
 class OutputFile {
 public:
     OutputFile(const std::string &filename);
+    // Collect the output in memory, see contents().
+    OutputFile() : f(nullptr) { }
+    OutputFile(const OutputFile &other) = delete;
     ~OutputFile();
 
-    void write_string(const std::string &string) { fputs(string.c_str(), f); };
-    void write_8(uint8_t value) { putc(value, f); }
+    void write_string(const std::string &string);
+    void write_8(uint8_t value) { if (f) { putc(value, f); } else { buffer.push_back(value); } }
     void write_16(uint16_t value);
     void write_24(uint32_t value);
     void write_32(uint32_t value);
-    void write_data(const std::vector<uint8_t> &data) { fwrite(data.data(), 1, data.size(), f); }
+    void write_64(uint64_t value);
+    void write_data(const std::vector<uint8_t> &data);
+    
+    // Output collected in memory.
+    const std::vector<uint8_t> &contents() const { return buffer; }
 
 private:
     FILE *f;
+    std::vector<uint8_t> buffer;
 };
 
 #endif // HAD_OUTPUT_FILE_H
@@ -0,0 +1,221 @@
+/*
+ PcmStream.cc -- read headerless PCM audio from a file or pipe.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PcmStream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Exception.h"
+#include "Stats.h"
+#include "Trace.h"
+
+const size_t PcmStream::RUN_LENGTH = 4096;
+const unsigned int PcmStream::FOLLOW_INTERVAL = 250; // milliseconds
+const unsigned int PcmStream::FOLLOW_TIMEOUT = 10000; // milliseconds
+
+PcmStream::PcmStream(const std::string &filename_, SampleFormat format_, int sample_rate_, Mixdown mixdown_, uint64_t offset, bool follow_) : filename(filename_), format(format_), mixdown(mixdown_), buffer_fill(0), buffer_used(0), end_of_file(false), remaining(UINT64_MAX), follow(follow_), interrupted(false) {
+    if (format.channels < 1) {
+        throw Exception("invalid number of channels");
+    }
+    if (sample_rate_ <= 0) {
+        throw Exception("invalid sample rate");
+    }
+    sample_rate = sample_rate_;
+    if (format.channels == 1) {
+        mixdown = LEFT;
+    }
+    
+    if (filename == "-") {
+        fd = STDIN_FILENO;
+        close_fd = false;
+        filename = "standard input";
+    }
+    else {
+        fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw Exception("can't open '" + filename + "': " + strerror(errno));
+        }
+        close_fd = true;
+    }
+    
+    if (offset > 0 && lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+        auto error = errno;
+        if (close_fd) {
+            close(fd);
+        }
+        throw Exception("can't seek in " + filename + ": " + strerror(error));
+    }
+    
+    struct stat st;
+    may_block = fstat(fd, &st) < 0 || !S_ISREG(st.st_mode);
+    
+    buffer.resize(RUN_LENGTH * format.frame_size());
+    output.resize(RUN_LENGTH);
+}
+
+
+PcmStream::~PcmStream() {
+    if (close_fd) {
+        close(fd);
+    }
+}
+
+
+size_t PcmStream::read(const int16_t **samples) {
+    const uint8_t *frames;
+    auto n = read_frames(&frames);
+    if (n == 0) {
+        return 0;
+    }
+    
+    auto timer = Stats::Timer(Stats::CONVERT);
+    convert(frames, n, output.data());
+    
+    *samples = output.data();
+    return n;
+}
+
+
+void PcmStream::measure_peak(uint64_t offset, uint64_t length) {
+    auto timer = Stats::Timer(Stats::READ);
+    auto frames = std::vector<uint8_t>(RUN_LENGTH * format.frame_size());
+    auto run = std::vector<int16_t>(RUN_LENGTH);
+    int32_t maximum = 0;
+    
+    while (length >= format.frame_size()) {
+        auto n = pread(fd, frames.data(), static_cast<size_t>(std::min(static_cast<uint64_t>(frames.size()), length)), static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw Exception("can't read from " + filename + ": " + strerror(errno));
+        }
+        auto num_frames = static_cast<size_t>(n) / format.frame_size();
+        if (num_frames == 0) {
+            break;
+        }
+        convert(frames.data(), num_frames, run.data());
+        for (size_t i = 0; i < num_frames; i++) {
+            maximum = std::max(maximum, std::abs(static_cast<int32_t>(run[i])));
+        }
+        offset += num_frames * format.frame_size();
+        length -= num_frames * format.frame_size();
+    }
+    
+    peak = static_cast<int16_t>(std::min(maximum, static_cast<int32_t>(INT16_MAX)));
+}
+
+
+size_t PcmStream::read_frames(const uint8_t **frames) {
+    memmove(buffer.data(), buffer.data() + buffer_used, buffer_fill - buffer_used);
+    buffer_fill -= buffer_used;
+    buffer_used = 0;
+    
+    fill_buffer();
+    
+    auto n = buffer_fill / format.frame_size();
+    if (n == 0) {
+        // A partial frame at the end of the data is dropped.
+        return 0;
+    }
+    
+    buffer_used = n * format.frame_size();
+    *frames = buffer.data();
+    return n;
+}
+
+
+void PcmStream::convert(const uint8_t *frames, size_t n, int16_t *samples) const {
+    switch (mixdown) {
+        case LEFT:
+            format.convert(frames, n, 0, samples);
+            break;
+        case RIGHT:
+            format.convert(frames, n, 1, samples);
+            break;
+        case BOTH:
+            format.mix(frames, n, samples);
+            break;
+    }
+}
+
+
+// Read until at least one complete frame is buffered. Returns as soon as some data is available, so detection keeps up with a live recording instead of waiting for a full buffer.
+void PcmStream::fill_buffer() {
+    auto timer = Stats::Timer(Stats::READ);
+    auto span = Trace::Span("read PCM");
+    unsigned int waited = 0;
+    
+    while (!end_of_file && buffer_fill < format.frame_size()) {
+        if (remaining == 0 || interrupted) {
+            end_of_file = true;
+            break;
+        }
+        if (may_block) {
+            // Wait for data in steps, so an interrupt is noticed even if none arrives.
+            auto poll_fd = pollfd{fd, POLLIN, 0};
+            auto ready = poll(&poll_fd, 1, static_cast<int>(FOLLOW_INTERVAL));
+            if (ready < 0 && errno != EINTR) {
+                throw Exception("can't read from " + filename + ": " + strerror(errno));
+            }
+            if (ready <= 0) {
+                continue;
+            }
+        }
+        auto n = ::read(fd, buffer.data() + buffer_fill, static_cast<size_t>(std::min(static_cast<uint64_t>(buffer.size() - buffer_fill), remaining)));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw Exception("can't read from " + filename + ": " + strerror(errno));
+        }
+        if (n == 0) {
+            if (follow && waited < FOLLOW_TIMEOUT) {
+                // The recording may still be running.
+                usleep(FOLLOW_INTERVAL * 1000);
+                waited += FOLLOW_INTERVAL;
+                continue;
+            }
+            end_of_file = true;
+        }
+        else {
+            waited = 0;
+            remaining -= static_cast<uint64_t>(n);
+        }
+        buffer_fill += static_cast<size_t>(n);
+    }
+}
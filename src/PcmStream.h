@@ -0,0 +1,86 @@
+/*
+ PcmStream.h -- read headerless PCM audio from a file or pipe.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HAD_PCM_STREAM_H
+#define HAD_PCM_STREAM_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "SampleFormat.h"
+#include "SampleSource.h"
+
+// Reads raw interleaved little endian samples as they arrive, so recordings can be piped in from arecord or sox.
+class PcmStream : public SampleSource {
+public:
+    // "-" reads standard input. Reading starts at offset. If follow is set, wait for more data at end of file until the file stops growing.
+    PcmStream(const std::string &filename, SampleFormat format, int sample_rate, Mixdown mixdown, uint64_t offset = 0, bool follow = false);
+    PcmStream(const PcmStream &other) = delete;
+    ~PcmStream();
+    
+    size_t read(const int16_t **samples) override;
+    void interrupt() override { interrupted = true; }
+    // Get the next run of complete frames without converting them. Returns the number of frames, 0 at end of data. The frames stay valid until the next call.
+    size_t read_frames(const uint8_t **frames);
+    
+    const SampleFormat &sample_format() const { return format; }
+    
+    // Stop after reading frames frames.
+    void limit(uint64_t frames) { remaining = frames * format.frame_size(); }
+    // Set peak to the largest amplitude in the length bytes of frames at offset, like Wav does for the whole file, so detection doesn't depend on where reading starts. Doesn't change the read position, so it only works on files.
+    void measure_peak(uint64_t offset, uint64_t length);
+    
+private:
+    int fd;
+    bool close_fd;
+    bool may_block; // reading from a pipe or terminal can wait indefinitely
+    std::string filename;
+    SampleFormat format;
+    Mixdown mixdown;
+    
+    std::vector<uint8_t> buffer;
+    size_t buffer_fill;
+    size_t buffer_used; // bytes handed out by the last call to read_frames
+    bool end_of_file;
+    uint64_t remaining; // bytes left to read before the limit is reached
+    bool follow;
+    std::atomic<bool> interrupted;
+    std::vector<int16_t> output;
+    
+    void fill_buffer();
+    void convert(const uint8_t *frames, size_t n, int16_t *samples) const;
+    
+    static const size_t RUN_LENGTH;
+    static const unsigned int FOLLOW_INTERVAL;
+    static const unsigned int FOLLOW_TIMEOUT;
+};
+
+#endif // HAD_PCM_STREAM_H
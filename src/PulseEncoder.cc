@@ -0,0 +1,138 @@
+/*
+ PulseEncoder.cc -- encode pulses of tapes in unknown formats as TZX.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PulseEncoder.h"
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+#include "BitVector.h"
+#include "Stats.h"
+#include "utility.h"
+
+const double PulseEncoder::TOLERANCE = 0.1; // relative difference of pulses that are given the same symbol
+
+
+void PulseEncoder::add_pulse(uint64_t duration) {
+    auto timer = Stats::Timer(Stats::ENCODE);
+    
+    if (silence > 0) {
+        write_pulses();
+        write_silence();
+    }
+    pulses.push_back(static_cast<uint16_t>(std::min(duration, static_cast<uint64_t>(UINT16_MAX))));
+}
+
+
+void PulseEncoder::add_silence(uint64_t duration) {
+    silence += duration;
+}
+
+
+void PulseEncoder::end() {
+    auto timer = Stats::Timer(Stats::ENCODE);
+    
+    write_pulses();
+}
+
+
+void PulseEncoder::write_pulses() {
+    if (pulses.empty()) {
+        return;
+    }
+    
+    if (compact) {
+        write_symbols();
+    }
+    else {
+        tzx.add_pulse_sequence(pulses);
+    }
+    pulses.clear();
+}
+
+
+void PulseEncoder::write_silence() {
+    auto milliseconds = silence / 3500;
+    
+    while (milliseconds > 0) {
+        auto length = static_cast<uint16_t>(std::min(milliseconds, static_cast<uint64_t>(UINT16_MAX)));
+        tzx.add_pause(length);
+        milliseconds -= length;
+    }
+    silence = 0;
+}
+
+
+// Group pulses of similar length into one symbol each, played back with their average length, and write the pulses as a stream of these symbols.
+void PulseEncoder::write_symbols() {
+    auto histogram = std::map<uint16_t, uint64_t>();
+    for (auto pulse : pulses) {
+        histogram[pulse] += 1;
+    }
+    
+    auto symbol_of = std::unordered_map<uint16_t, size_t>();
+    auto symbols = TZX::GeneralizedDataBlock::SymbolDefinitions();
+    uint16_t first = 0;
+    uint64_t total = 0;
+    uint64_t count = 0;
+    
+    auto add_symbol = [&]() {
+        symbols.emplace_back(0, std::vector<uint16_t>{ static_cast<uint16_t>((total + count / 2) / count) });
+    };
+    
+    for (const auto &entry : histogram) {
+        if (count > 0 && entry.first > first * (1 + TOLERANCE)) {
+            add_symbol();
+            count = 0;
+            total = 0;
+        }
+        if (count == 0) {
+            first = entry.first;
+        }
+        symbol_of[entry.first] = symbols.size();
+        total += static_cast<uint64_t>(entry.first) * entry.second;
+        count += entry.second;
+    }
+    add_symbol();
+    if (symbols.size() == 1) {
+        // Symbols must take at least one bit.
+        symbols.push_back(symbols.back());
+    }
+    
+    auto bits_per_symbol = number_of_bits(symbols.size());
+    auto data = BitVector();
+    data.reserve(pulses.size() * bits_per_symbol);
+    for (auto pulse : pulses) {
+        data.append_bits(symbol_of[pulse], bits_per_symbol);
+    }
+    
+    tzx.add_general_data(TZX::GeneralizedDataBlock(0, {}, {}, symbols, static_cast<uint32_t>(pulses.size()), data.bytes()));
+}
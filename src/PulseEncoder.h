@@ -0,0 +1,62 @@
+#ifndef HAD_PULSE_ENCODER_H
+#define HAD_PULSE_ENCODER_H
+
+/*
+ PulseEncoder.h -- encode pulses of tapes in unknown formats as TZX.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include "TZX.h"
+
+class PulseEncoder {
+public:
+    PulseEncoder(TZX &tzx_, bool compact_) : tzx(tzx_), compact(compact_), silence(0) { }
+    
+    // Durations are in T-states at 3.5MHz.
+    void add_pulse(uint64_t duration);
+    void add_silence(uint64_t duration);
+    void end();
+    
+private:
+    TZX &tzx;
+    bool compact; // cluster pulse durations into symbols instead of writing each duration
+    
+    std::vector<uint16_t> pulses; // since the last silence
+    uint64_t silence; // since the last pulse
+    
+    void write_pulses();
+    void write_silence();
+    void write_symbols();
+    
+    static const double TOLERANCE;
+};
+
+#endif // HAD_PULSE_ENCODER_H
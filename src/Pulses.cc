@@ -30,8 +30,25 @@
 
 #include "Pulses.h"
 
-Pulses::Pulses(Wav wav_) : wav(wav_) {
-    cutoff = wav.peek * 1 / 16;
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+#include "Exception.h"
+#include "Stats.h"
+#include "Trace.h"
+
+const size_t Pulses::END = SIZE_MAX;
+const size_t Pulses::CHUNK_SIZE = 4096;
+const size_t Pulses::RING_SIZE = 8;
+const size_t Pulses::WINDOW = 65536; // much longer than a sync leader
+const uint64_t Pulses::MINIMUM_SILENCE = 20; // milliseconds, much longer than any pulse
+const Pulse Pulses::end_of_data = Pulse(Pulse::SILENCE, 0);
+
+Pulses::Pulses(std::unique_ptr<SampleSource> source_, const State &state) : source(std::move(source_)), samples(nullptr), samples_available(0), run_length(0), end_of_samples(false), bit_planes(false), phase(state.phase), count(0), position(state.position), first(0), first_state(state), current_state(state), end_of_pulses(false), record_interval(0) {
+    peak = std::max(static_cast<int32_t>(source->peak), state.peak);
+    cutoff = peak * 1 / 16;
+    silence_length = static_cast<uint64_t>(source->sample_rate) * MINIMUM_SILENCE / 1000;
 }
 
 std::string Pulse::type_name() const {
@@ -48,103 +65,379 @@ std::string Pulse::type_name() const {
     return "invalid";
 }
 
-Pulses::Iterator::Iterator(const Pulses &pulses_, bool end) : pulses(pulses_), phase(START), count(0), current_pulse(Pulse::SILENCE, 0) {
-    if (end) {
-        current = pulses.wav.samples.end();
+
+void Pulses::start_thread() {
+    if (!thread.joinable()) {
+        ring = std::make_unique<Ring<Chunk>>(RING_SIZE);
+        thread = std::thread(&Pulses::run, this);
     }
-    else {
-        current = pulses.wav.samples.begin();
-        next();
+}
+
+
+void Pulses::stop_thread() {
+    if (thread.joinable()) {
+        ring->close();
+        // The thread may be waiting for samples, which can take indefinitely when reading a recording as it is made.
+        source->interrupt();
+        thread.join();
     }
 }
 
-void Pulses::Iterator::next() {
-    // TODO: detect silence in the middle of the file
+
+bool Pulses::ensure(size_t index) {
+    if (index < first) {
+        throw Exception("pulse " + std::to_string(index) + " is no longer available");
+    }
+    // Dropping only once twice the window has accumulated keeps the cost of moving the remaining pulses down constant per pulse.
+    if (index != END && index - first >= 2 * WINDOW) {
+        drop(index - first - WINDOW);
+    }
+    while (index >= first + pulses.size()) {
+        if (end_of_pulses) {
+            return false;
+        }
+        if (ring) {
+            if (!ring->pop(received)) {
+                end_of_pulses = true;
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+                return false;
+            }
+            append(received);
+        }
+        else {
+            detect_chunk();
+            append(chunk);
+        }
+    }
     
-    while (current < pulses.wav.samples.end()) {
-        auto sample = *current;
-        current++;
-        count += 1;
-        
-#if 0
-        if (sample < -pulses.cutoff) {
-            printf("%d < <\n", sample);
+    return true;
+}
+
+
+Pulses::State Pulses::state(size_t index) const {
+    if (index < first) {
+        throw Exception("pulse " + std::to_string(index) + " is no longer available");
+    }
+    if (index == first) {
+        return first_state;
+    }
+    if (index > first + boundaries.size()) {
+        return current_state;
+    }
+    
+    auto &boundary = boundaries[index - first - 1];
+    return State(boundary.position, boundary.phase, current_state.peak);
+}
+
+
+size_t Pulses::skip(size_t index, uint64_t duration) {
+    uint64_t skipped = 0;
+    
+    while (skipped < duration && ensure(index)) {
+        for (; index < first + pulses.size() && skipped < duration; index++) {
+            auto &pulse = pulses[index - first];
+            if (!pulse.is_pulse()) {
+                return index;
+            }
+            skipped += pulse.duration;
         }
-        else if (sample <= pulses.cutoff) {
-            printf("< %d <\n", sample);
+    }
+    
+    return index;
+}
+
+
+void Pulses::append(const Chunk &detected) {
+    auto timer = Stats::Timer(Stats::DETECT);
+    auto start = first + pulses.size();
+    pulses.insert(pulses.end(), detected.pulses.begin(), detected.pulses.end());
+    boundaries.insert(boundaries.end(), detected.boundaries.begin(), detected.boundaries.end());
+    current_state = detected.end_state;
+    if (detected.end_of_samples) {
+        end_of_pulses = true;
+    }
+    
+    if (record_callback) {
+        for (auto number = (start + record_interval - 1) / record_interval * record_interval; number < first + pulses.size(); number += record_interval) {
+            record_callback(number, state(number));
+        }
+    }
+}
+
+
+// Forget the oldest count pulses.
+void Pulses::drop(size_t count) {
+    first_state = state(first + count);
+    pulses.erase(pulses.begin(), pulses.begin() + static_cast<ptrdiff_t>(count));
+    boundaries.erase(boundaries.begin(), boundaries.begin() + static_cast<ptrdiff_t>(count));
+    first += count;
+}
+
+
+void Pulses::run() {
+    Trace::name_thread("detect pulses");
+    
+    try {
+        while (!end_of_samples) {
+            detect_chunk();
+            if (!ring->push(chunk)) {
+                break;
+            }
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    
+    ring->close();
+}
+
+
+void Pulses::detect_chunk() {
+    auto timer = Stats::Timer(Stats::DETECT);
+    auto span = Trace::Span("detect pulses", static_cast<int64_t>(position));
+    auto start_position = position;
+    
+    chunk.pulses.clear();
+    chunk.boundaries.clear();
+    
+    while (chunk.pulses.size() < CHUNK_SIZE) {
+        if (samples_available == 0 && !read_samples()) {
+            break;
+        }
+        if (bit_planes) {
+            detect_planes();
+        }
+        else if (phase == START) {
+            skip_silence();
         }
         else {
-            printf("< < %d\n", sample);
+            detect_sample();
         }
+    }
+    
+    chunk.end_state = State(position, phase, peak);
+    chunk.end_of_samples = end_of_samples;
+    
+    Stats::count(Stats::SAMPLES, position - start_position);
+    Stats::count(Stats::PULSES, chunk.pulses.size());
+}
+
+
+void Pulses::detect_sample() {
+    auto sample = *samples;
+    samples++;
+    samples_available--;
+    position++;
+    count += 1;
+    
+    if (phase != START && count > silence_length) {
+        // No edge for too long, the signal is gone. The samples since the last pulse become part of the silence.
+        phase = START;
+    }
+    
+#if 0
+    if (sample < -cutoff) {
+        printf("%d < <\n", sample);
+    }
+    else if (sample <= cutoff) {
+        printf("< %d <\n", sample);
+    }
+    else {
+        printf("< < %d\n", sample);
+    }
 #endif
 
-        switch (phase) {
-        case START:
-            if (sample > pulses.cutoff) {
-                phase = PLUS_FALLING;
-                if (count > 2) {
-                    set_pulse(Pulse::SILENCE);
-                    return;
-                }
+    switch (phase) {
+    case START:
+        if (sample > cutoff) {
+            phase = PLUS_FALLING;
+            if (count > 2) {
+                add_pulse(Pulse::SILENCE);
             }
-            else if (sample < -pulses.cutoff) {
+        }
+        else if (sample < -cutoff) {
+            phase = MINUS_RISING;
+            if (count > 2) {
+                add_pulse(Pulse::SILENCE);
+            }
+        }
+        break;
+        
+    case PLUS_RISING:
+        if (sample > cutoff) {
+            phase = PLUS_FALLING;
+        }
+        else if (sample < -cutoff) {
+            diagnostics.add(Diagnostics::MISSING_POSITIVE_PEAK, position - 1);
+        }
+        break;
+        
+    case PLUS_FALLING:
+        if (sample < 0) {
+            if (sample < -cutoff) {
                 phase = MINUS_RISING;
-                if (count > 2) {
-                    set_pulse(Pulse::SILENCE);
-                    return;
-                }
             }
-            break;
-            
-        case PLUS_RISING:
-            if (sample > pulses.cutoff) {
+            else {
+                phase = MINUS_FALLING;
+            }
+            add_pulse(Pulse::POSITIVE);
+        }
+        break;
+        
+    case MINUS_FALLING:
+        if (sample < -cutoff) {
+            phase = MINUS_RISING;
+        }
+        else if (sample > cutoff) {
+            diagnostics.add(Diagnostics::MISSING_NEGATIVE_PEAK, position - 1);
+        }
+        break;
+        
+    case MINUS_RISING:
+        if (sample > 0) {
+            if (sample > cutoff) {
                 phase = PLUS_FALLING;
             }
-            else if (sample < -pulses.cutoff) {
-                printf("ERROR: missing positive peak\n");
+            else {
+                phase = PLUS_RISING;
             }
+            add_pulse(Pulse::NEGATIVE);
+        }
+    }
+}
+
+
+// Skip samples between the cutoffs in bulk, then handle the first one outside them like detect_sample.
+void Pulses::skip_silence() {
+    auto n = BitPlanes::find_outside(samples, samples_available, cutoff);
+    samples += n;
+    samples_available -= n;
+    position += n;
+    count += n;
+    
+    if (samples_available > 0) {
+        detect_sample();
+    }
+}
+
+
+// Skip to the next sample that changes the phase, using the bit planes of the current run.
+void Pulses::detect_planes() {
+    auto start = run_length - samples_available;
+    auto end = run_length;
+    
+    if (phase != START && count + 1 > silence_length) {
+        // Like detect_sample: the next sample is past the silence, the signal is gone.
+        phase = START;
+    }
+    if (phase != START) {
+        // Only look at the samples detect_sample would still handle in this phase.
+        end = std::min(end, start + static_cast<size_t>(silence_length - count));
+    }
+    auto next = end;
+    
+    switch (phase) {
+        case START:
+            next = planes.find_next(BitPlanes::ABOVE_CUTOFF, BitPlanes::BELOW_CUTOFF, start, end);
+            break;
+            
+        case PLUS_RISING:
+            next = planes.find_next(BitPlanes::ABOVE_CUTOFF, start, end);
+            add_missing_peaks(BitPlanes::BELOW_CUTOFF, Diagnostics::MISSING_POSITIVE_PEAK, start, next);
             break;
             
         case PLUS_FALLING:
-            if (sample < 0) {
-                if (sample < -pulses.cutoff) {
-                    phase = MINUS_RISING;
-                }
-                else {
-                    phase = MINUS_FALLING;
-                }
-                set_pulse(Pulse::POSITIVE);
-                return;
-            }
+            next = planes.find_next(BitPlanes::NEGATIVE, start, end);
             break;
             
         case MINUS_FALLING:
-            if (sample < -pulses.cutoff) {
-                phase = MINUS_RISING;
-            }
-            else if (sample > pulses.cutoff) {
-                printf("ERROR: missing negative peak\n");
-            }
+            next = planes.find_next(BitPlanes::BELOW_CUTOFF, start, end);
+            add_missing_peaks(BitPlanes::ABOVE_CUTOFF, Diagnostics::MISSING_NEGATIVE_PEAK, start, next);
             break;
             
         case MINUS_RISING:
-            if (sample > 0) {
-                if (sample > pulses.cutoff) {
-                    phase = PLUS_FALLING;
-                }
-                else {
-                    phase = PLUS_RISING;
-                }
-                set_pulse(Pulse::NEGATIVE);
-                return;
+            next = planes.find_next(BitPlanes::POSITIVE, start, end);
+            break;
+    }
+    
+    auto consumed = (next < end ? next + 1 : end) - start;
+    samples += consumed;
+    samples_available -= consumed;
+    position += consumed;
+    count += consumed;
+    
+    if (next == end) {
+        return;
+    }
+    
+    switch (phase) {
+        case START:
+            phase = planes.test(BitPlanes::ABOVE_CUTOFF, next) ? PLUS_FALLING : MINUS_RISING;
+            if (count > 2) {
+                add_pulse(Pulse::SILENCE);
             }
-        }
+            break;
+            
+        case PLUS_RISING:
+            phase = PLUS_FALLING;
+            break;
+            
+        case PLUS_FALLING:
+            phase = planes.test(BitPlanes::BELOW_CUTOFF, next) ? MINUS_RISING : MINUS_FALLING;
+            add_pulse(Pulse::POSITIVE);
+            break;
+            
+        case MINUS_FALLING:
+            phase = MINUS_RISING;
+            break;
+            
+        case MINUS_RISING:
+            phase = planes.test(BitPlanes::ABOVE_CUTOFF, next) ? PLUS_FALLING : PLUS_RISING;
+            add_pulse(Pulse::NEGATIVE);
+            break;
     }
+}
 
+
+void Pulses::add_missing_peaks(BitPlanes::Plane plane, Diagnostics::Type type, size_t start, size_t end) {
+    // position is the index of the sample at start.
+    for (auto index = planes.find_next(plane, start, end); index < end; index = planes.find_next(plane, index + 1, end)) {
+        diagnostics.add(type, position + (index - start));
+    }
 }
 
-void Pulses::Iterator::set_pulse(Pulse::Type type) {
-    current_pulse = Pulse(type, count * 3500000 / pulses.wav.sample_rate);
-    // printf("PULSE: %s %llu\n", current_pulse.type_name().c_str(), current_pulse.duration);
+
+bool Pulses::read_samples() {
+    samples_available = source->read(&samples);
+    
+    if (samples_available == 0) {
+        end_of_samples = true;
+        return false;
+    }
+    
+    if (source->peak == 0) {
+        // Peak is not known in advance, use the largest amplitude seen so far.
+        for (size_t i = 0; i < samples_available; i++) {
+            peak = std::max(peak, std::abs(static_cast<int32_t>(samples[i])));
+        }
+        cutoff = peak * 1 / 16;
+    }
+    
+    run_length = samples_available;
+    if (bit_planes) {
+        planes.quantize(samples, samples_available, cutoff);
+    }
+    
+    return true;
+}
+
+
+void Pulses::add_pulse(Pulse::Type type) {
+    chunk.pulses.emplace_back(type, count * 3500000 / source->sample_rate);
+    chunk.boundaries.emplace_back(position, phase);
+    // printf("PULSE: %s %llu\n", chunk.pulses.back().type_name().c_str(), chunk.pulses.back().duration);
     count = 0;
 }
@@ -32,8 +32,20 @@
  */
 
 #include <cinttypes>
+#include <cstddef>
+#include <iterator>
 
-#include "Wav.h"
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BitPlanes.h"
+#include "Diagnostics.h"
+#include "Ring.h"
+#include "SampleSource.h"
 
 class Pulse {
 public:
@@ -53,18 +65,45 @@ public:
 
 class Pulses {
 public:
+    enum Phase {
+        START,
+        PLUS_RISING,
+        PLUS_FALLING,
+        MINUS_FALLING,
+        MINUS_RISING
+    };
+    
+    // Detector state between two pulses, enough to continue detection from that sample position.
+    class State {
+    public:
+        State() : position(0), phase(START), peak(0) { }
+        State(uint64_t position_, Phase phase_, int32_t peak_) : position(position_), phase(phase_), peak(peak_) { }
+        
+        uint64_t position;
+        Phase phase;
+        int32_t peak;
+    };
+    
     class Iterator {
     public:
         using iterator_category = std::forward_iterator_tag;
         using difference_type   = int64_t;
         using value_type        = Pulse;
-        using pointer           = Pulse *;  // or also value_type*
-        using reference         = Pulse &;  // or also value_type&
+        using pointer           = const Pulse *;  // or also value_type*
+        using reference         = const Pulse &;  // or also value_type&
 
-        Iterator(const Pulses &pulses, bool end = false);
+        Iterator(Pulses &pulses_, size_t index_) : pulses(&pulses_), index(index_) { normalize(); }
+        
+        // Detector state before the current pulse.
+        State state() const { return pulses->state(index); }
+        // Number of the current pulse, counted from where detection started.
+        size_t number() const { return index; }
         
-        reference operator*() const { return const_cast<Pulse &>(current_pulse); }
-        pointer operator->() { return &current_pulse; }
+        reference operator*() const { return pulses->get(index); }
+        pointer operator->() const { return &pulses->get(index); }
+        
+        // Skip pulses until their total duration reaches duration, stopping before silence.
+        void skip(uint64_t duration) { if (index != END) { index = pulses->skip(index, duration); normalize(); } }
         
         // Prefix increment
         Iterator& operator++() { next(); return *this; }
@@ -72,38 +111,118 @@ public:
         // Postfix increment
         Iterator operator++(int) { Iterator tmp = *this; next(); return tmp; }
         
-        friend bool operator== (const Iterator& a, const Iterator& b) { return a.current == b.current; };
-        friend bool operator!= (const Iterator& a, const Iterator& b) { return a.current != b.current; };
+        friend bool operator== (const Iterator& a, const Iterator& b) { return a.index == b.index; };
+        friend bool operator!= (const Iterator& a, const Iterator& b) { return a.index != b.index; };
 
     private:
-        enum Phase {
-            START,
-            PLUS_RISING,
-            PLUS_FALLING,
-            MINUS_FALLING,
-            MINUS_RISING
-        };
+        Pulses *pulses;
+        size_t index;
+
+        void next() { if (index != END) { index += 1; normalize(); } }
+        void normalize() { if (index != END && !pulses->ensure(index)) { index = END; } }
+    };
+    
+    Pulses(std::unique_ptr<SampleSource> source) : Pulses(std::move(source), State()) { }
+    // Continue detection from state, source must be positioned at state.position.
+    Pulses(std::unique_ptr<SampleSource> source, const State &state);
+    Pulses(const Pulses &other) = delete;
+    ~Pulses() { stop_thread(); }
+    
+    // Find pulse edges on packed comparator bit planes instead of sample by sample. Must be called before the first iterator is created.
+    void use_bit_planes(bool value) { bit_planes = value; }
+    
+    // Detect pulses on a separate thread, ahead of their use. Must be called before the first iterator is created.
+    void start_thread();
+    // Stop detection thread. Call before accessing diagnostics.
+    void stop_thread();
+    
+    // Call callback with the detector state before every interval-th pulse, as the pulses are handed out. Must be called before the first iterator is created.
+    void record_states(size_t interval, std::function<void(size_t number, const State &state)> callback) { record_interval = interval; record_callback = callback; }
+    
+    Iterator begin() { return Iterator(*this, first); }
+    Iterator end() { return Iterator(*this, END); }
+    
+    Diagnostics diagnostics;
+    
+    // Number of pulses kept before the furthest one accessed. Iterators must not fall further behind than that.
+    static const size_t WINDOW;
         
-        const Pulses &pulses;
+private:
+    class Boundary {
+    public:
+        Boundary(uint64_t position_, Phase phase_) : position(position_), phase(phase_) { }
         
+        uint64_t position;
         Phase phase;
-        uint64_t count;
-        std::vector<int16_t>::const_iterator current;
-        
-        Pulse current_pulse;
+    };
+    
+    // Pulses detected in one go, with the detector state after the last one.
+    class Chunk {
+    public:
+        Chunk() : end_of_samples(false) { }
         
-        void next();
-        void set_pulse(Pulse::Type type);
+        std::vector<Pulse> pulses;
+        std::vector<Boundary> boundaries;
+        State end_state;
+        bool end_of_samples;
     };
     
-    Pulses(Wav wav);
+    // Detector state before pulse index, which must not be past the pulses detected so far.
+    State state(size_t index) const;
     
-    Iterator begin() { return Iterator(*this); }
-    Iterator end() { return Iterator(*this, true); }
-        
-private:
-    Wav wav;
+    // Detector, used by the detection thread if running.
+    std::unique_ptr<SampleSource> source;
+    const int16_t *samples;
+    size_t samples_available;
+    size_t run_length;
+    bool end_of_samples;
+    bool bit_planes;
+    BitPlanes planes; // of the current run, if bit_planes is set
+    
+    int32_t peak;
     int32_t cutoff;
+    
+    Phase phase;
+    uint64_t count; // samples since the last pulse
+    uint64_t silence_length; // in samples, without an edge for this long the signal is considered gone
+    uint64_t position;
+    Chunk chunk;
+    
+    // Pulses handed to the consumer and not yet dropped, starting with pulse number first.
+    size_t first;
+    std::vector<Pulse> pulses;
+    State first_state; // state before pulse first
+    std::vector<Boundary> boundaries; // state after each pulse
+    State current_state;
+    bool end_of_pulses;
+    Chunk received;
+    size_t record_interval;
+    std::function<void(size_t number, const State &state)> record_callback;
+    
+    std::unique_ptr<Ring<Chunk>> ring;
+    std::thread thread;
+    std::exception_ptr error; // written by the detection thread before closing the ring
+    
+    bool ensure(size_t index);
+    size_t skip(size_t index, uint64_t duration);
+    const Pulse &get(size_t index) { return ensure(index) ? pulses[index - first] : end_of_data; }
+    
+    void append(const Chunk &detected);
+    void drop(size_t count);
+    void detect_chunk();
+    void detect_sample();
+    void skip_silence();
+    void detect_planes();
+    void add_missing_peaks(BitPlanes::Plane plane, Diagnostics::Type type, size_t start, size_t end);
+    void run();
+    bool read_samples();
+    void add_pulse(Pulse::Type type);
+    
+    static const size_t END;
+    static const size_t CHUNK_SIZE;
+    static const uint64_t MINIMUM_SILENCE;
+    static const size_t RING_SIZE;
+    static const Pulse end_of_data;
 };
 
 #endif // HAD_PULSES_H
@@ -0,0 +1,140 @@
+/*
+ ResultCache.cc -- on-disk cache of conversion results.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ResultCache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "Exception.h"
+#include "OutputFile.h"
+#include "Stats.h"
+#include "utility.h"
+
+// Bump when the conversion changes in a way that makes old results invalid.
+const std::string ResultCache::version = "1";
+
+ResultCache::ResultCache(const std::string &directory_, uint64_t maximum_size_) : directory(directory_), maximum_size(maximum_size_) {
+    auto error = std::error_code();
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        throw Exception("can't create cache directory '" + directory + "': " + error.message());
+    }
+}
+
+
+std::string ResultCache::key(const uint8_t *input, size_t length, const std::string &parameters) {
+    auto settings = version + "\n" + parameters;
+    char key[64];
+    
+    snprintf(key, sizeof(key), "%016" PRIx64 "-%" PRIx64 "-%016" PRIx64, hash_data(input, length, 0), static_cast<uint64_t>(length), hash_data(reinterpret_cast<const uint8_t *>(settings.data()), settings.size(), 0));
+    return key;
+}
+
+
+std::optional<std::vector<uint8_t>> ResultCache::get(const std::string &key) {
+    auto name = filename(key);
+    auto error = std::error_code();
+    
+    if (!std::filesystem::is_regular_file(name, error)) {
+        Stats::count(Stats::CACHE_MISSES);
+        return {};
+    }
+    
+    auto result = get_file_contents(name);
+    // Mark as recently used.
+    std::filesystem::last_write_time(name, std::filesystem::file_time_type::clock::now(), error);
+    Stats::count(Stats::CACHE_HITS);
+    return result;
+}
+
+
+void ResultCache::put(const std::string &key, const std::vector<uint8_t> &result) {
+    if (result.size() <= maximum_size) {
+        auto name = filename(key);
+        auto temporary = name + ".new";
+        {
+            auto file = OutputFile(temporary);
+            file.write_data(result);
+        }
+        if (rename(temporary.c_str(), name.c_str()) < 0) {
+            throw Exception("can't rename '" + temporary + "' to '" + name + "': " + strerror(errno));
+        }
+    }
+    
+    evict();
+}
+
+
+void ResultCache::evict() {
+    class Entry {
+    public:
+        Entry(const std::filesystem::path &path_, std::filesystem::file_time_type time_, uint64_t size_) : path(path_), time(time_), size(size_) { }
+        
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+        uint64_t size;
+    };
+    
+    auto entries = std::vector<Entry>();
+    uint64_t total_size = 0;
+    auto error = std::error_code();
+    
+    for (const auto &entry : std::filesystem::directory_iterator(directory, error)) {
+        if (!entry.is_regular_file(error) || entry.path().extension() == ".new") {
+            continue;
+        }
+        auto size = entry.file_size(error);
+        if (error) {
+            continue;
+        }
+        entries.emplace_back(entry.path(), entry.last_write_time(error), size);
+        total_size += size;
+    }
+    
+    if (total_size <= maximum_size) {
+        return;
+    }
+    
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.time < b.time; });
+    
+    for (const auto &entry : entries) {
+        if (total_size <= maximum_size) {
+            break;
+        }
+        if (std::filesystem::remove(entry.path, error)) {
+            total_size -= entry.size;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ ResultCache.h -- on-disk cache of conversion results.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HAD_RESULT_CACHE_H
+#define HAD_RESULT_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Stores conversion results in a directory, keyed by a hash of the input and the parameters that influence the result. The least recently used entries are removed when the total size exceeds the limit.
+class ResultCache {
+public:
+    ResultCache(const std::string &directory, uint64_t maximum_size);
+    
+    static std::string key(const uint8_t *input, size_t length, const std::string &parameters);
+    
+    std::optional<std::vector<uint8_t>> get(const std::string &key);
+    void put(const std::string &key, const std::vector<uint8_t> &result);
+    
+private:
+    std::string directory;
+    uint64_t maximum_size;
+    
+    std::string filename(const std::string &key) const { return directory + "/" + key; }
+    void evict();
+    
+    static const std::string version;
+};
+
+#endif // HAD_RESULT_CACHE_H
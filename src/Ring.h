@@ -0,0 +1,104 @@
+/*
+ Ring.h -- bounded single producer, single consumer queue.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HAD_RING_H
+#define HAD_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A bounded queue between exactly one producer and one consumer thread, without locks.
+// Values are exchanged by swapping, so the producer gets back the values the consumer is done with and can reuse their storage.
+template <typename T>
+class Ring {
+public:
+    explicit Ring(size_t capacity) : slots(capacity), head(0), tail(0), closed(false) { }
+    Ring(const Ring &other) = delete;
+    
+    // Add value, waiting while the ring is full. value is replaced with a previously consumed one. Returns false if the ring was closed.
+    bool push(T &value) {
+        auto position = tail.load(std::memory_order_relaxed);
+        unsigned int waits = 0;
+        while (position - head.load(std::memory_order_acquire) == slots.size()) {
+            if (closed.load(std::memory_order_acquire)) {
+                return false;
+            }
+            wait(waits);
+        }
+        std::swap(slots[position % slots.size()], value);
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // Remove the oldest value into value, waiting while the ring is empty. The previous contents of value are kept for reuse by the producer. Returns false at end of data.
+    bool pop(T &value) {
+        auto position = head.load(std::memory_order_relaxed);
+        unsigned int waits = 0;
+        while (tail.load(std::memory_order_acquire) == position) {
+            if (closed.load(std::memory_order_acquire)) {
+                // Values pushed before closing are still delivered.
+                if (tail.load(std::memory_order_acquire) == position) {
+                    return false;
+                }
+                break;
+            }
+            wait(waits);
+        }
+        std::swap(slots[position % slots.size()], value);
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // Called by the producer at end of data, or by the consumer to stop the producer.
+    void close() { closed.store(true, std::memory_order_release); }
+    
+private:
+    std::vector<T> slots;
+    std::atomic<size_t> head; // next slot to pop, only written by consumer
+    std::atomic<size_t> tail; // next slot to push, only written by producer
+    std::atomic<bool> closed;
+    
+    // Spin briefly, since the other side is usually about to catch up, then back off to avoid burning a core.
+    static void wait(unsigned int &waits) {
+        if (waits < 64) {
+            std::this_thread::yield();
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        waits += 1;
+    }
+};
+
+#endif // HAD_RING_H
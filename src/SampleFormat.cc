@@ -0,0 +1,323 @@
+/*
+ SampleFormat.cc -- convert audio samples to 16 bit.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SampleFormat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Buffer.h"
+#include "Exception.h"
+
+// The kernels read their input byte by byte, so they work regardless of host byte order. Compilers don't vectorize these strided loops, so there are explicit SSE2 versions for the common mono and stereo layouts; the scalar loops convert whatever is left.
+
+const size_t SampleFormat::RUN_LENGTH = 4096;
+
+const std::unordered_map<std::string, SampleFormat::Encoding> SampleFormat::encoding_names = {
+    { "u8", UNSIGNED_8 },
+    { "s8", SIGNED_8 },
+    { "s16", SIGNED_16 },
+    { "s24", SIGNED_24 },
+    { "s32", SIGNED_32 },
+    { "float", FLOAT_32 }
+};
+
+
+SampleFormat::Encoding SampleFormat::encoding_by_name(const std::string &name) {
+    auto it = encoding_names.find(name);
+    
+    if (it == encoding_names.end()) {
+        throw Exception("unknown sample format '" + name + "'");
+    }
+    
+    return it->second;
+}
+
+
+size_t SampleFormat::sample_size() const {
+    switch (encoding) {
+        case UNSIGNED_8:
+        case SIGNED_8:
+            return 1;
+        case SIGNED_16:
+            return 2;
+        case SIGNED_24:
+            return 3;
+        case SIGNED_32:
+        case FLOAT_32:
+            return 4;
+    }
+    
+    throw Exception("invalid sample encoding");
+}
+
+
+std::string SampleFormat::name() const {
+    switch (encoding) {
+        case UNSIGNED_8:
+            return "8 bit unsigned";
+        case SIGNED_8:
+            return "8 bit signed";
+        case SIGNED_16:
+            return "16 bit signed";
+        case SIGNED_24:
+            return "24 bit signed";
+        case SIGNED_32:
+            return "32 bit signed";
+        case FLOAT_32:
+            return "32 bit float";
+    }
+    
+    return "invalid";
+}
+
+
+void SampleFormat::convert(const uint8_t *frames, size_t n, size_t channel, int16_t *samples) const {
+    if (channel >= channels) {
+        throw Exception("invalid channel");
+    }
+    
+    auto in = frames + channel * sample_size();
+    auto stride = frame_size();
+    
+    switch (encoding) {
+        case UNSIGNED_8:
+            convert_unsigned_8(in, stride, n, samples);
+            break;
+        case SIGNED_8:
+            convert_signed_8(in, stride, n, samples);
+            break;
+        case SIGNED_16:
+            convert_signed_16(in, stride, n, samples);
+            break;
+        case SIGNED_24:
+            convert_signed_24(in, stride, n, samples);
+            break;
+        case SIGNED_32:
+            convert_signed_32(in, stride, n, samples);
+            break;
+        case FLOAT_32:
+            convert_float_32(in, stride, n, samples);
+            break;
+    }
+}
+
+
+void SampleFormat::mix(const uint8_t *frames, size_t n, int16_t *samples) const {
+    if (channels < 2) {
+        convert(frames, n, 0, samples);
+        return;
+    }
+    
+    int16_t other[RUN_LENGTH];
+    
+    for (size_t start = 0; start < n; start += RUN_LENGTH) {
+        auto length = std::min(RUN_LENGTH, n - start);
+        auto out = samples + start;
+        auto in = frames + start * frame_size();
+        
+        convert(in, length, 0, out);
+        convert(in, length, 1, other);
+        for (size_t i = 0; i < length; i++) {
+            out[i] = static_cast<int16_t>((out[i] + other[i]) / 2);
+        }
+    }
+}
+
+
+void SampleFormat::convert_unsigned_8(const uint8_t *in, size_t stride, size_t n, int16_t *out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = static_cast<int16_t>(in[i * stride] * 0x101 - 0x8000);
+    }
+}
+
+
+void SampleFormat::convert_signed_8(const uint8_t *in, size_t stride, size_t n, int16_t *out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = static_cast<int16_t>((in[i * stride] ^ 0x80) * 0x101 - 0x8000);
+    }
+}
+
+
+void SampleFormat::convert_signed_16(const uint8_t *in, size_t stride, size_t n, int16_t *out) {
+    if (stride == 2) {
+        // Already in our sample format, only the byte order may need fixing.
+        Buffer(in, n * 2).get_int16_array(n, out);
+        return;
+    }
+    
+    size_t i = 0;
+    
+#ifdef __SSE2__
+    if (stride == 4) {
+        // Keep the low half of each 32 bit lane. Stop one frame early, since the last load reads past the final sample of the other channel.
+        for (; i + 8 < n; i += 8) {
+            auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 4));
+            auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 4 + 16));
+            a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+            b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(a, b));
+        }
+    }
+#endif
+    
+    for (; i < n; i++) {
+        auto p = in + i * stride;
+        out[i] = static_cast<int16_t>(p[0] | (p[1] << 8));
+    }
+}
+
+
+void SampleFormat::convert_signed_24(const uint8_t *in, size_t stride, size_t n, int16_t *out) {
+    size_t i = 0;
+    
+#ifdef __SSE2__
+    // Move four samples into the 32 bit lanes, then keep bytes 1 and 2 of each lane. Stop two frames early, since the loads read past the last sample converted.
+    auto lane_0 = _mm_set_epi32(0, 0, 0, -1);
+    auto lane_1 = _mm_set_epi32(0, 0, -1, 0);
+    auto lane_2 = _mm_set_epi32(0, -1, 0, 0);
+    auto lane_3 = _mm_set_epi32(-1, 0, 0, 0);
+    auto merge = [&](__m128i a, __m128i b, __m128i c, __m128i d) {
+        auto lanes = _mm_or_si128(_mm_or_si128(_mm_and_si128(a, lane_0), _mm_and_si128(b, lane_1)), _mm_or_si128(_mm_and_si128(c, lane_2), _mm_and_si128(d, lane_3)));
+        return _mm_srai_epi32(_mm_slli_epi32(lanes, 8), 16);
+    };
+    
+    if (stride == 3) {
+        auto mono = [&](const uint8_t *p) {
+            auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            return merge(x, _mm_slli_si128(x, 1), _mm_slli_si128(x, 2), _mm_slli_si128(x, 3));
+        };
+        for (; i + 10 <= n; i += 8) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(mono(in + i * 3), mono(in + i * 3 + 12)));
+        }
+    }
+    else if (stride == 6) {
+        auto stereo = [&](const uint8_t *p) {
+            auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            auto y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 12));
+            return merge(x, _mm_srli_si128(x, 2), _mm_slli_si128(y, 8), _mm_slli_si128(y, 6));
+        };
+        for (; i + 10 <= n; i += 8) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(stereo(in + i * 6), stereo(in + i * 6 + 24)));
+        }
+    }
+#endif
+    
+    for (; i < n; i++) {
+        auto p = in + i * stride;
+        out[i] = static_cast<int16_t>(p[1] | (p[2] << 8));
+    }
+}
+
+
+void SampleFormat::convert_signed_32(const uint8_t *in, size_t stride, size_t n, int16_t *out) {
+    size_t i = 0;
+    
+#ifdef __SSE2__
+    // Keep the upper half of each sample.
+    auto load = [](const uint8_t *p) { return _mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), 16); };
+    
+    if (stride == 4) {
+        for (; i + 8 <= n; i += 8) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(load(in + i * 4), load(in + i * 4 + 16)));
+        }
+    }
+    else if (stride == 8) {
+        // Stop one frame early, since the last load reads past the final sample of the other channel.
+        auto even = [](__m128i a, __m128i b) { return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0))); };
+        for (; i + 8 < n; i += 8) {
+            auto p = in + i * 8;
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(even(load(p), load(p + 16)), even(load(p + 32), load(p + 48))));
+        }
+    }
+#endif
+    
+    for (; i < n; i++) {
+        auto p = in + i * stride;
+        out[i] = static_cast<int16_t>(p[2] | (p[3] << 8));
+    }
+}
+
+
+void SampleFormat::convert_float_32(const uint8_t *in, size_t stride, size_t n, int16_t *out) {
+    size_t i = 0;
+    
+#ifdef __SSE2__
+    // Clamping before the conversion also maps NaN to -32768, like float_to_sample. Conversion rounds to nearest.
+    auto scale = _mm_set1_ps(32768.0f);
+    auto minimum = _mm_set1_ps(-32768.0f);
+    auto maximum = _mm_set1_ps(32767.0f);
+    auto to_samples = [&](__m128 value) { return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(value, scale), minimum), maximum)); };
+    
+    if (stride == 4) {
+        for (; i + 8 <= n; i += 8) {
+            auto p = reinterpret_cast<const float *>(in + i * 4);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(to_samples(_mm_loadu_ps(p)), to_samples(_mm_loadu_ps(p + 4))));
+        }
+    }
+    else if (stride == 8) {
+        // Stop one frame early, since the last load reads past the final sample of the other channel.
+        for (; i + 8 < n; i += 8) {
+            auto p = reinterpret_cast<const float *>(in + i * 8);
+            auto a = _mm_shuffle_ps(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _MM_SHUFFLE(2, 0, 2, 0));
+            auto b = _mm_shuffle_ps(_mm_loadu_ps(p + 8), _mm_loadu_ps(p + 12), _MM_SHUFFLE(2, 0, 2, 0));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(to_samples(a), to_samples(b)));
+        }
+    }
+#endif
+    
+    for (; i < n; i++) {
+        auto p = in + i * stride;
+        uint32_t bits = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+        float value;
+        std::memcpy(&value, &bits, 4);
+        out[i] = float_to_sample(value);
+    }
+}
+
+
+int16_t SampleFormat::float_to_sample(float value) {
+    value *= 32768.0f;
+    
+    if (value >= 32767.0f) {
+        return 32767;
+    }
+    else if (value > -32768.0f) {
+        return static_cast<int16_t>(std::lrint(value));
+    }
+    else {
+        return -32768;
+    }
+}
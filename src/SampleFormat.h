@@ -0,0 +1,80 @@
+#ifndef HAD_SAMPLE_FORMAT_H
+#define HAD_SAMPLE_FORMAT_H
+
+/*
+ SampleFormat.h -- convert audio samples to 16 bit.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+class SampleFormat {
+public:
+    enum Encoding {
+        UNSIGNED_8,
+        SIGNED_8,
+        SIGNED_16,
+        SIGNED_24,
+        SIGNED_32,
+        FLOAT_32
+    };
+    
+    SampleFormat(Encoding encoding_, size_t channels_) : encoding(encoding_), channels(channels_) { }
+    
+    static Encoding encoding_by_name(const std::string &name);
+    
+    size_t sample_size() const;
+    size_t frame_size() const { return sample_size() * channels; }
+    std::string name() const;
+
+    // Convert one channel of n interleaved little endian frames to 16 bit signed samples.
+    void convert(const uint8_t *frames, size_t n, size_t channel, int16_t *samples) const;
+    // Convert the average of the first two channels of n interleaved frames.
+    void mix(const uint8_t *frames, size_t n, int16_t *samples) const;
+    
+    Encoding encoding;
+    size_t channels;
+    
+private:
+    static void convert_unsigned_8(const uint8_t *in, size_t stride, size_t n, int16_t *out);
+    static void convert_signed_8(const uint8_t *in, size_t stride, size_t n, int16_t *out);
+    static void convert_signed_16(const uint8_t *in, size_t stride, size_t n, int16_t *out);
+    static void convert_signed_24(const uint8_t *in, size_t stride, size_t n, int16_t *out);
+    static void convert_signed_32(const uint8_t *in, size_t stride, size_t n, int16_t *out);
+    static void convert_float_32(const uint8_t *in, size_t stride, size_t n, int16_t *out);
+    
+    static int16_t float_to_sample(float value);
+    
+    static const size_t RUN_LENGTH;
+    static const std::unordered_map<std::string, Encoding> encoding_names;
+};
+
+#endif // HAD_SAMPLE_FORMAT_H
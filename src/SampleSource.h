@@ -0,0 +1,57 @@
+#ifndef HAD_SAMPLE_SOURCE_H
+#define HAD_SAMPLE_SOURCE_H
+
+/*
+ SampleSource.h -- provider of mono 16 bit audio samples.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+class SampleSource {
+public:
+    enum Mixdown {
+        LEFT,
+        BOTH,
+        RIGHT
+    };
+
+    SampleSource() : sample_rate(0), peak(0) { }
+    virtual ~SampleSource() { }
+    
+    // Get the next run of samples. Returns the number of samples, 0 at end of data. The samples stay valid until the next call.
+    virtual size_t read(const int16_t **samples) = 0;
+    // Make a read waiting for input on another thread return 0 soon, and all reads after it. Sources that never wait need not implement this.
+    virtual void interrupt() { }
+    
+    int sample_rate;
+    int16_t peak; // 0 if not known before all samples have been read
+};
+
+#endif // HAD_SAMPLE_SOURCE_H
@@ -0,0 +1,193 @@
+/*
+ SeekIndex.cc -- positions of pulses, syncs and blocks in a recording.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SeekIndex.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "Buffer.h"
+#include "Exception.h"
+#include "OutputFile.h"
+#include "utility.h"
+
+const size_t SeekIndex::INTERVAL = 4096;
+const std::string SeekIndex::magic = "TI99TAPE-INDEX-4";
+
+SeekIndex SeekIndex::load(const std::string &filename) {
+    auto contents = get_file_contents(filename);
+    auto buffer = Buffer(contents);
+    auto index = SeekIndex();
+    
+    if (buffer.remaining() < magic.size() || buffer.get_string(magic.size()) != magic) {
+        throw Exception("'" + filename + "' is not a seek index");
+    }
+    index.input = InputIdentity::read(buffer);
+    
+    auto num_points = buffer.get_uint32();
+    for (uint32_t i = 0; i < num_points; i++) {
+        auto pulse = buffer.get_uint64();
+        index.points.emplace_back(pulse, get_state(buffer, filename));
+    }
+    
+    auto num_marks = buffer.get_uint32();
+    for (uint32_t i = 0; i < num_marks; i++) {
+        auto type = buffer.get_uint8();
+        if (type > Mark::BLOCK) {
+            throw Exception("invalid mark type in '" + filename + "'");
+        }
+        auto file = buffer.get_uint32();
+        auto block = buffer.get_uint8();
+        auto copy = buffer.get_uint8();
+        auto pulse = buffer.get_uint64();
+        index.marks.emplace_back(static_cast<Mark::Type>(type), file, block, copy, pulse, get_state(buffer, filename));
+        if (type == Mark::SYNC) {
+            index.number_of_files = file + 1;
+        }
+    }
+    
+    return index;
+}
+
+
+void SeekIndex::save(const std::string &filename) const {
+    auto temporary = filename + ".new";
+    {
+        auto file = OutputFile(temporary);
+        file.write_string(magic);
+        input.write(file);
+        file.write_32(static_cast<uint32_t>(points.size()));
+        for (auto &point : points) {
+            file.write_64(point.pulse);
+            write_state(file, point.state);
+        }
+        file.write_32(static_cast<uint32_t>(marks.size()));
+        for (auto &mark : marks) {
+            file.write_8(static_cast<uint8_t>(mark.type));
+            file.write_32(mark.file);
+            file.write_8(mark.block);
+            file.write_8(mark.copy);
+            file.write_64(mark.pulse);
+            write_state(file, mark.state);
+        }
+    }
+    if (rename(temporary.c_str(), filename.c_str()) < 0) {
+        throw Exception("can't rename '" + temporary + "' to '" + filename + "': " + strerror(errno));
+    }
+}
+
+
+void SeekIndex::add_sync(const Pulses::Iterator &pulse) {
+    marks.emplace_back(Mark::SYNC, number_of_files, 0, 0, pulse.number(), pulse.state());
+    number_of_files += 1;
+}
+
+
+void SeekIndex::add_block(uint8_t block, uint8_t copy, const Pulses::Iterator &pulse) {
+    if (number_of_files == 0) {
+        throw Exception("block without sync");
+    }
+    marks.emplace_back(Mark::BLOCK, number_of_files - 1, block, copy, pulse.number(), pulse.state());
+}
+
+
+const SeekIndex::Point &SeekIndex::point_before(uint64_t position) const {
+    if (points.empty()) {
+        throw Exception("empty seek index");
+    }
+    
+    auto it = std::upper_bound(points.begin(), points.end(), position, [](uint64_t position, const Point &point) { return position < point.state.position; });
+    if (it == points.begin()) {
+        return points.front();
+    }
+    return *(it - 1);
+}
+
+
+const SeekIndex::Mark *SeekIndex::find_sync(uint32_t file) const {
+    for (auto &mark : marks) {
+        if (mark.type == Mark::SYNC && mark.file == file) {
+            return &mark;
+        }
+    }
+    
+    return nullptr;
+}
+
+
+const SeekIndex::Mark *SeekIndex::find_block(uint32_t file, uint8_t block, uint8_t copy) const {
+    for (auto &mark : marks) {
+        if (mark.type == Mark::BLOCK && mark.file == file && mark.block == block && mark.copy == copy) {
+            return &mark;
+        }
+    }
+    
+    return nullptr;
+}
+
+
+const SeekIndex::Mark *SeekIndex::find_sync_after(uint64_t position) const {
+    for (size_t i = 0; i < marks.size(); i++) {
+        if (marks[i].type != Mark::SYNC) {
+            continue;
+        }
+        // The sync of the first block follows the header. Decoding from a position in the leader or header still finds this file.
+        auto header_end = marks[i].state.position;
+        if (i + 1 < marks.size() && marks[i + 1].type == Mark::BLOCK && marks[i + 1].file == marks[i].file) {
+            header_end = marks[i + 1].state.position;
+        }
+        if (header_end >= position) {
+            return &marks[i];
+        }
+    }
+    
+    return nullptr;
+}
+
+
+Pulses::State SeekIndex::get_state(Buffer &buffer, const std::string &filename) {
+    auto position = buffer.get_uint64();
+    auto phase = buffer.get_uint8();
+    if (phase > Pulses::MINUS_RISING) {
+        throw Exception("invalid pulse phase in '" + filename + "'");
+    }
+    auto peak = buffer.get_int32();
+    
+    return Pulses::State(position, static_cast<Pulses::Phase>(phase), peak);
+}
+
+
+void SeekIndex::write_state(OutputFile &file, const Pulses::State &state) {
+    file.write_64(state.position);
+    file.write_8(static_cast<uint8_t>(state.phase));
+    file.write_32(static_cast<uint32_t>(state.peak));
+}
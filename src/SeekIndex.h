@@ -0,0 +1,111 @@
+#ifndef HAD_SEEK_INDEX_H
+#define HAD_SEEK_INDEX_H
+
+/*
+ SeekIndex.h -- positions of pulses, syncs and blocks in a recording.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Buffer.h"
+#include "InputIdentity.h"
+#include "OutputFile.h"
+#include "Pulses.h"
+
+// Built while decoding a recording from its beginning and saved next to it, so later runs can start pulse detection close to the region they need.
+class SeekIndex {
+public:
+    // Detector state before a pulse, taken at regular intervals.
+    class Point {
+    public:
+        Point(uint64_t pulse_, const Pulses::State &state_) : pulse(pulse_), state(state_) { }
+        
+        uint64_t pulse; // number of pulse, counted from the start of the recording
+        Pulses::State state;
+    };
+    
+    // Start of the sync leader of a file or of the sync of a block copy, with the detector state to continue from there.
+    class Mark {
+    public:
+        enum Type {
+            SYNC,
+            BLOCK
+        };
+        
+        Mark(Type type_, uint32_t file_, uint8_t block_, uint8_t copy_, uint64_t pulse_, const Pulses::State &state_) : type(type_), file(file_), block(block_), copy(copy_), pulse(pulse_), state(state_) { }
+        
+        Type type;
+        uint32_t file; // counted from 0, only files whose header could be read are counted
+        uint8_t block;
+        uint8_t copy;
+        uint64_t pulse;
+        Pulses::State state;
+    };
+    
+    SeekIndex() : number_of_files(0) { }
+    
+    static SeekIndex load(const std::string &filename);
+    void save(const std::string &filename) const;
+    
+    // Name of the index file for a recording.
+    static std::string filename(const std::string &recording) { return recording + ".index"; }
+    // Check that the recording hasn't changed since the index was built.
+    bool matches(const std::string &recording, uint64_t data_offset) const { return input.matches(recording, data_offset); }
+    
+    void add_point(uint64_t pulse, const Pulses::State &state) { points.emplace_back(pulse, state); }
+    // Add the sync of the next file.
+    void add_sync(const Pulses::Iterator &pulse);
+    // Add the sync of a block copy of the last file added.
+    void add_block(uint8_t block, uint8_t copy, const Pulses::Iterator &pulse);
+    
+    // Last point at or before sample position.
+    const Point &point_before(uint64_t position) const;
+    // These return nullptr if there is no such mark.
+    const Mark *find_sync(uint32_t file) const;
+    const Mark *find_block(uint32_t file, uint8_t block, uint8_t copy) const;
+    // Sync of the first file whose header comes after sample position, so decoding from there finds the same file as decoding from position.
+    const Mark *find_sync_after(uint64_t position) const;
+    
+    InputIdentity input; // recording the index was built for
+    std::vector<Point> points;
+    std::vector<Mark> marks;
+    uint32_t number_of_files;
+    
+    static const size_t INTERVAL; // pulses between points
+    
+private:
+    static Pulses::State get_state(Buffer &buffer, const std::string &filename);
+    static void write_state(OutputFile &file, const Pulses::State &state);
+    
+    static const std::string magic;
+};
+
+#endif // HAD_SEEK_INDEX_H
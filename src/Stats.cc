@@ -0,0 +1,164 @@
+/*
+ Stats.cc -- timing and counters for conversion stages.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Stats.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <ctime>
+#include <sys/resource.h>
+
+std::atomic<uint64_t> Stats::counters[NUMBER_OF_COUNTERS];
+std::atomic<uint64_t> Stats::wall_time[NUMBER_OF_STAGES];
+std::atomic<uint64_t> Stats::cpu_time[NUMBER_OF_STAGES];
+
+thread_local Stats::Timer *Stats::current_timer = nullptr;
+
+
+Stats::Timer::Timer(Stage stage_) : stage(stage_), outer(current_timer) {
+    wall_start = wall_clock();
+    cpu_start = cpu_clock();
+    if (outer != nullptr) {
+        outer->account(wall_start, cpu_start);
+    }
+    current_timer = this;
+}
+
+
+Stats::Timer::~Timer() {
+    auto wall_now = wall_clock();
+    auto cpu_now = cpu_clock();
+    account(wall_now, cpu_now);
+    if (outer != nullptr) {
+        outer->wall_start = wall_now;
+        outer->cpu_start = cpu_now;
+    }
+    current_timer = outer;
+}
+
+
+void Stats::Timer::account(uint64_t wall_now, uint64_t cpu_now) {
+    wall_time[stage].fetch_add(wall_now - wall_start, std::memory_order_relaxed);
+    cpu_time[stage].fetch_add(cpu_now - cpu_start, std::memory_order_relaxed);
+    wall_start = wall_now;
+    cpu_start = cpu_now;
+}
+
+
+const char *Stats::name(Stage stage) {
+    switch (stage) {
+        case READ:
+            return "read";
+        case CONVERT:
+            return "convert";
+        case DETECT:
+            return "detect";
+        case DECODE:
+            return "decode";
+        case ENCODE:
+            return "encode";
+        case SCAN:
+            return "scan";
+        case NUMBER_OF_STAGES:
+            break;
+    }
+    
+    return "invalid";
+}
+
+
+const char *Stats::name(Counter counter) {
+    switch (counter) {
+        case SAMPLES:
+            return "samples";
+        case PULSES:
+            return "pulses";
+        case SYNC_ATTEMPTS:
+            return "sync_attempts";
+        case DATA_MARK_FAILURES:
+            return "data_mark_failures";
+        case CHECKSUM_FAILURES:
+            return "checksum_failures";
+        case BLOCKS_RECOVERED:
+            return "blocks_recovered";
+        case CACHE_HITS:
+            return "cache_hits";
+        case CACHE_MISSES:
+            return "cache_misses";
+        case NUMBER_OF_COUNTERS:
+            break;
+    }
+    
+    return "invalid";
+}
+
+
+uint64_t Stats::peak_rss() {
+    struct rusage usage;
+    
+    if (getrusage(RUSAGE_SELF, &usage) < 0) {
+        return 0;
+    }
+    
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+
+void Stats::write_json(FILE *f) {
+    fprintf(f, "{\n  \"stages\": {\n");
+    for (auto i = 0; i < NUMBER_OF_STAGES; i++) {
+        fprintf(f, "    \"%s\": { \"wall\": %.6f, \"cpu\": %.6f }%s\n", name(static_cast<Stage>(i)), wall_time[i].load() / 1e9, cpu_time[i].load() / 1e9, i + 1 < NUMBER_OF_STAGES ? "," : "");
+    }
+    fprintf(f, "  },\n  \"counters\": {\n");
+    for (auto i = 0; i < NUMBER_OF_COUNTERS; i++) {
+        fprintf(f, "    \"%s\": %" PRIu64 ",\n", name(static_cast<Counter>(i)), get(static_cast<Counter>(i)));
+    }
+    fprintf(f, "    \"peak_rss\": %" PRIu64 "\n  }\n}\n", peak_rss());
+}
+
+
+uint64_t Stats::wall_clock() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+uint64_t Stats::cpu_clock() {
+    struct timespec ts;
+    
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+        return 0;
+    }
+    
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
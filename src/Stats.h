@@ -0,0 +1,98 @@
+#ifndef HAD_STATS_H
+#define HAD_STATS_H
+
+/*
+ Stats.h -- timing and counters for conversion stages.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+class Stats {
+public:
+    enum Stage {
+        READ,
+        CONVERT,
+        DETECT,
+        DECODE,
+        ENCODE,
+        SCAN,
+        NUMBER_OF_STAGES
+    };
+    
+    enum Counter {
+        SAMPLES,
+        PULSES,
+        SYNC_ATTEMPTS,
+        DATA_MARK_FAILURES,
+        CHECKSUM_FAILURES,
+        BLOCKS_RECOVERED,
+        CACHE_HITS,
+        CACHE_MISSES,
+        NUMBER_OF_COUNTERS
+    };
+    
+    // Measures wall and CPU time spent in a stage. Timers nest per thread: while an inner timer runs, the outer one is paused, so each stage only accounts for its own time.
+    class Timer {
+    public:
+        explicit Timer(Stage stage);
+        Timer(const Timer &other) = delete;
+        ~Timer();
+
+    private:
+        Stage stage;
+        Timer *outer;
+        uint64_t wall_start;
+        uint64_t cpu_start;
+        
+        void account(uint64_t wall_now, uint64_t cpu_now);
+    };
+    
+    static void count(Counter counter, uint64_t amount = 1) { counters[counter].fetch_add(amount, std::memory_order_relaxed); }
+    static uint64_t get(Counter counter) { return counters[counter].load(std::memory_order_relaxed); }
+    static uint64_t peak_rss();
+
+    static void write_json(FILE *f);
+    
+    static const char *name(Stage stage);
+    static const char *name(Counter counter);
+
+private:
+    static std::atomic<uint64_t> counters[NUMBER_OF_COUNTERS];
+    static std::atomic<uint64_t> wall_time[NUMBER_OF_STAGES];
+    static std::atomic<uint64_t> cpu_time[NUMBER_OF_STAGES];
+    
+    static thread_local Timer *current_timer;
+    
+    static uint64_t wall_clock();
+    static uint64_t cpu_clock();
+};
+
+#endif // HAD_STATS_H
@@ -30,95 +30,201 @@
 
 #include "TI99TapeDecoder.h"
 
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "Buffer.h"
+#include "OutputFile.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "utility.h"
+
+const size_t TI99TapeDecoder::BLOCK_SIZE = 64;
+const uint64_t TI99TapeDecoder::BLOCK_BITS = 74 * 8; // sync, data mark, data, checksum
+const uint64_t TI99TapeDecoder::SYNC_BITS = 768 * 8 + 3 * 8; // leader, data mark, number of blocks twice
+const uint64_t TI99TapeDecoder::SKIP_MARGIN_BITS = 16;
 const uint64_t TI99TapeDecoder::SYNC_SKIP_BEGINNING = 10;
 const uint64_t TI99TapeDecoder::SYNC_MINIMUM_COUNT = 200;
+const std::string TI99TapeDecoder::State::magic = "TI99TAPE-STATE-2";
+
+std::string TI99TapeDecoder::DecodeException::name(ErrorCode code) {
+    switch (code) {
+        case OK:
+            return "ok";
+        case CRC_ERROR:
+            return "crc error";
+        case ENCODING_ERROR:
+            return "encoding error";
+        case OUT_OF_DATA:
+            return "out of data";
+        case NO_DATA:
+            return "no data";
+        case NO_SYNC:
+            return "no sync";
+    }
+    
+    return "invalid";
+}
+
 
 std::vector<uint8_t> TI99TapeDecoder::decode() {
-    auto data = std::vector<uint8_t>();
+    auto timer = Stats::Timer(Stats::DECODE);
 
-    read_sync();
-    
-    auto number_of_blocks = read_byte();
-    if (number_of_blocks != read_byte()) {
-        // number of blocks mismatch
+    if (!state.synced) {
+        read_header();
+        save_checkpoint();
+    }
+    else if (block_callback) {
+        // Report the blocks read before decoding was interrupted.
+        for (uint8_t index = 0; index < state.block && (index + 1) * BLOCK_SIZE <= state.data.size(); index++) {
+            auto block = Block(index, state.number_of_blocks, state.data.data() + index * BLOCK_SIZE);
+            block.restored = true;
+            block_callback(block);
+        }
     }
-    //printf("DEBUG: number of blocks: %u\n", number_of_blocks);
     
-    for (uint8_t block = 0; block < number_of_blocks; block++) {
-        std::vector<uint8_t> data0;
-        std::vector<uint8_t> data1;
+    state.data.reserve(state.number_of_blocks * BLOCK_SIZE);
+    
+    std::array<uint8_t, 64> data0;
+    std::array<uint8_t, 64> data1;
+
+    while (state.block < state.number_of_blocks) {
+        auto span = Trace::Span("decode block", state.block);
         auto status0 = DecodeException(DecodeException::OK, "OK");
         auto status1 = DecodeException(DecodeException::OK, "OK");
         
         try {
-            data0 = read_block();
+            read_block(data0, 0);
         }
         catch (DecodeException &ex) {
             status0 = ex;
         }
-        try {
-            data1 = read_block();
+        auto skipped = false;
+        if (status0.error == DecodeException::OK && !verify) {
+            skip_block();
+            skipped = true;
         }
-        catch (DecodeException &ex) {
-            status1 = ex;
+        else {
+            try {
+                read_block(data1, 1);
+            }
+            catch (DecodeException &ex) {
+                status1 = ex;
+            }
         }
         
-        //printf("DEBUG: read block %u: %s, %s\n", block, message0.c_str(), message1.c_str());
+        //printf("DEBUG: read block %u: %s, %s\n", state.block, message0.c_str(), message1.c_str());
 
+        auto block = Block(state.block, state.number_of_blocks, data0.data());
+        block.status[0] = status0.error;
+        block.status[1] = status1.error;
+        block.copy_skipped = skipped;
+        
         if (status0.error == DecodeException::OK) {
-            if (status1.error == DecodeException::OK) {
-                // compare data?
+            if (!skipped && status1.error == DecodeException::OK) {
+                block.copies_differ = data0 != data1;
             }
-            data.insert(data.end(), data0.begin(), data0.end());
         }
         else if (status1.error == DecodeException::OK) {
-            data.insert(data.end(), data1.begin(), data1.end());
+            Stats::count(Stats::BLOCKS_RECOVERED);
+            block.copy = 1;
+            block.data = data1.data();
         }
         else {
             throw status0.error <= status1.error ? status0 : status1;
         }
+        
+        state.data.insert(state.data.end(), block.data, block.data + BLOCK_SIZE);
+        state.block += 1;
+        if (block_callback) {
+            block_callback(block);
+        }
+        save_checkpoint();
     }
     
-    //printf("DEBUG: got %zu bytes of data\n", data.size());
-    return data;
+    //printf("DEBUG: got %zu bytes of data\n", state.data.size());
+    return state.data;
 }
 
 
-std::vector<uint8_t> TI99TapeDecoder::read_block() {
-    read_block_sync();
+uint8_t TI99TapeDecoder::read_header() {
+    auto timer = Stats::Timer(Stats::DECODE);
+
+    auto leader_start = read_sync();
     
-    std::vector<uint8_t> data;
+    state.number_of_blocks = read_byte();
+    if (state.number_of_blocks != read_byte()) {
+        // number of blocks mismatch
+    }
+    //printf("DEBUG: number of blocks: %u\n", state.number_of_blocks);
+    state.synced = true;
+    if (index) {
+        index->add_sync(leader_start);
+    }
+    
+    return state.number_of_blocks;
+}
+
+
+uint64_t TI99TapeDecoder::file_duration() const {
+    return (SYNC_BITS + state.number_of_blocks * 2 * BLOCK_BITS) * state.zero_length;
+}
+
+
+void TI99TapeDecoder::save_checkpoint() {
+    if (checkpoint) {
+        state.pulses = pulse_iterator.state();
+        checkpoint(state);
+    }
+}
+
+
+void TI99TapeDecoder::read_block(std::array<uint8_t, 64> &data, uint8_t copy) {
+    read_block_sync(copy);
     
     uint8_t checksum = 0;
-    for (auto i = 0; i < 64; i++) {
-        auto byte = read_byte();
-        data.push_back(byte);
+    for (auto &byte : data) {
+        byte = read_byte();
         checksum += byte;
     }
     
     if (read_byte() != checksum) {
+        Stats::count(Stats::CHECKSUM_FAILURES);
         throw DecodeException(DecodeException::CRC_ERROR, "crc error in block");
     }
-    
-    return data;
 }
 
 
-void TI99TapeDecoder::read_block_sync() {
+// Every bit takes the time of one zero pulse, so a block copy has a fixed duration. Stop a little early, so the sync of the next block is found by read_block_sync.
+void TI99TapeDecoder::skip_block() {
+    pulse_iterator.skip((BLOCK_BITS - SKIP_MARGIN_BITS) * state.zero_length);
+}
+
+
+void TI99TapeDecoder::read_block_sync(uint8_t copy) {
     auto count = 0;
+    auto sync_start = pulse_iterator;
     
     while (1) {
+        if (count == 0) {
+            sync_start = pulse_iterator;
+        }
         auto pulse = *(pulse_iterator++);
         
         if (!pulse.is_pulse()) {
             throw DecodeException(DecodeException::NO_DATA, "end of data in block sync");
         }
         
-        if (pulse.duration < long_pulse_threshold) {
+        if (pulse.duration < state.long_pulse_threshold) {
             if (count > 56) {
                 // Data sync is 8 00 bytes, which is 64 long pulses. Allow for up to 8 of them being consumed by the previous block read in error.
+                Stats::count(Stats::SYNC_ATTEMPTS);
                 try {
                     read_data_mark();
+                    if (index) {
+                        index->add_block(state.block, copy, sync_start);
+                    }
                     return;
                 }
                 catch (DecodeException &ex) { }
@@ -144,9 +250,9 @@ uint8_t TI99TapeDecoder::read_byte() {
         }
         
         auto bit = 0;
-        if (pulse.duration < long_pulse_threshold) {
+        if (pulse.duration < state.long_pulse_threshold) {
             auto pulse = *pulse_iterator;
-            if (pulse.duration >= long_pulse_threshold) {
+            if (pulse.duration >= state.long_pulse_threshold) {
                 throw DecodeException(DecodeException::NO_DATA, "lone short pulse"); // TODO: other code
             }
             pulse_iterator++;
@@ -164,41 +270,61 @@ void TI99TapeDecoder::read_data_mark() {
     for (auto i = 0; i < 15; i++) {
         auto pulse = *(pulse_iterator++);
         if (pulse.type != Pulse::POSITIVE && pulse.type != Pulse::NEGATIVE) {
+            Stats::count(Stats::DATA_MARK_FAILURES);
             throw DecodeException(DecodeException::NO_DATA, "missing pulse in data mark");
         }
-        if (pulse.duration >= long_pulse_threshold) {
+        if (pulse.duration >= state.long_pulse_threshold) {
+            Stats::count(Stats::DATA_MARK_FAILURES);
             throw DecodeException(DecodeException::ENCODING_ERROR, "missing data mark");
         }
     }
 }
 
 
-void TI99TapeDecoder::read_sync() {
+// Returns the start of the leader.
+Pulses::Iterator TI99TapeDecoder::read_sync() {
     uint64_t sync_length = 0;
     uint64_t sync_count = 0;
+    // Start of the current run of pulses of similar length.
+    auto leader_start = pulse_iterator;
+    uint64_t previous_duration = 0;
 
     while (1) {
         if (pulse_iterator == end) {
             throw DecodeException(DecodeException::NO_SYNC, "no sync found");
         }
         
-        auto const &pulse = *(pulse_iterator++);
+        auto current = pulse_iterator;
+        auto pulse = *(pulse_iterator++);
         
         switch (pulse.type) {
             case Pulse::SILENCE:
                 // TODO: handle error: silence in middle of sync; reset and try again?
+                leader_start = pulse_iterator;
+                previous_duration = 0;
                 break;
                 
             case Pulse::NEGATIVE:
             case Pulse::POSITIVE:
                 if (sync_count > SYNC_MINIMUM_COUNT) {
-                    zero_length = sync_length / (sync_count - SYNC_SKIP_BEGINNING);
-                    long_pulse_threshold = zero_length * 3 / 4;
-                    if (pulse.duration < long_pulse_threshold) {
+                    state.zero_length = sync_length / (sync_count - SYNC_SKIP_BEGINNING);
+                    state.long_pulse_threshold = state.zero_length * 3 / 4;
+                    if (pulse.duration < state.long_pulse_threshold) {
                         read_data_mark();
-                        return;
+                        return leader_start;
                     }
                 }
+                if (pulse.duration * 4 < previous_duration * 3 || pulse.duration * 3 > previous_duration * 4) {
+                    // Not part of the leader, which consists of pulses of equal length. Only measure the zero length over the run starting here.
+                    leader_start = current;
+                    sync_length = 0;
+                    sync_count = 0;
+                }
+                else if (current.number() - leader_start.number() >= Pulses::WINDOW / 2) {
+                    // Restart long runs, so their start is still available when the sync is found. A real leader is much shorter.
+                    leader_start = current;
+                }
+                previous_duration = pulse.duration;
                 if (sync_count >= SYNC_SKIP_BEGINNING) {
                     sync_length += pulse.duration;
                 }
@@ -207,3 +333,56 @@ void TI99TapeDecoder::read_sync() {
         }
     }
 }
+
+
+TI99TapeDecoder::State TI99TapeDecoder::State::load(const std::string &filename) {
+    auto contents = get_file_contents(filename);
+    auto buffer = Buffer(contents);
+    auto state = State();
+    
+    if (buffer.remaining() < magic.size() || buffer.get_string(magic.size()) != magic) {
+        throw Exception("'" + filename + "' is not a decoder state file");
+    }
+    state.input = InputIdentity::read(buffer);
+    state.pulses.position = buffer.get_uint64();
+    auto phase = buffer.get_uint8();
+    if (phase > Pulses::MINUS_RISING) {
+        throw Exception("invalid pulse phase in '" + filename + "'");
+    }
+    state.pulses.phase = static_cast<Pulses::Phase>(phase);
+    state.pulses.peak = buffer.get_int32();
+    state.synced = buffer.get_uint8() != 0;
+    state.zero_length = buffer.get_uint64();
+    state.long_pulse_threshold = buffer.get_uint64();
+    state.number_of_blocks = buffer.get_uint8();
+    state.block = buffer.get_uint8();
+    auto length = buffer.get_uint32();
+    auto data = buffer.get_data(length);
+    state.data.assign(data, data + length);
+    
+    return state;
+}
+
+
+void TI99TapeDecoder::State::save(const std::string &filename) const {
+    // Write to a temporary file and rename it, so an interrupted save doesn't destroy the previous state.
+    auto temporary = filename + ".new";
+    {
+        auto file = OutputFile(temporary);
+        file.write_string(magic);
+        input.write(file);
+        file.write_64(pulses.position);
+        file.write_8(static_cast<uint8_t>(pulses.phase));
+        file.write_32(static_cast<uint32_t>(pulses.peak));
+        file.write_8(synced ? 1 : 0);
+        file.write_64(zero_length);
+        file.write_64(long_pulse_threshold);
+        file.write_8(number_of_blocks);
+        file.write_8(block);
+        file.write_32(static_cast<uint32_t>(data.size()));
+        file.write_data(data);
+    }
+    if (rename(temporary.c_str(), filename.c_str()) < 0) {
+        throw Exception("can't rename '" + temporary + "' to '" + filename + "': " + strerror(errno));
+    }
+}
@@ -31,8 +31,15 @@
  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <array>
+#include <functional>
+#include <string>
+#include <vector>
+
 #include "Exception.h"
+#include "InputIdentity.h"
 #include "Pulses.h"
+#include "SeekIndex.h"
 
 class TI99TapeDecoder {
 public:
@@ -49,27 +56,90 @@ public:
         
         DecodeException(ErrorCode code, const std::string &message) : Exception(message), error(code) { }
         DecodeException(const DecodeException &other) : Exception(other.message), error(other.error) { }
+        
+        static std::string name(ErrorCode code);
 
         ErrorCode error;
     };
 
-    TI99TapeDecoder(Pulses::Iterator begin, Pulses::Iterator end_) : pulse_iterator(begin), end(end_) { }
+    // Progress of decoding, taken between blocks. Decoding can be continued from it later on, with pulse detection starting at pulses.position.
+    class State {
+    public:
+        State() : synced(false), zero_length(0), long_pulse_threshold(0), number_of_blocks(0), block(0) { }
+        
+        static State load(const std::string &filename);
+        void save(const std::string &filename) const;
+        
+        bool synced;
+        uint64_t zero_length;
+        uint64_t long_pulse_threshold;
+        uint8_t number_of_blocks;
+        uint8_t block; // next block to read
+        std::vector<uint8_t> data; // contents of the blocks read so far
+        Pulses::State pulses;
+        InputIdentity input; // recording the state belongs to
+        
+    private:
+        static const std::string magic;
+    };
+    
+    // A block as soon as it has been accepted, with how well it was read.
+    class Block {
+    public:
+        Block(uint8_t index_, uint8_t number_of_blocks_, const uint8_t *data_) : index(index_), number_of_blocks(number_of_blocks_), data(data_), copy(0), status{DecodeException::OK, DecodeException::OK}, copy_skipped(false), copies_differ(false), restored(false) { }
+        
+        uint8_t index;
+        uint8_t number_of_blocks;
+        const uint8_t *data; // BLOCK_SIZE bytes, only valid during the callback
+        
+        uint8_t copy; // which of the two recorded copies was used
+        DecodeException::ErrorCode status[2]; // result of reading each copy
+        bool copy_skipped; // the first copy was good, so the second one wasn't read
+        bool copies_differ; // both copies were read successfully but don't match
+        bool restored; // taken from a saved state, no quality information available
+    };
+    
+    TI99TapeDecoder(Pulses::Iterator begin, Pulses::Iterator end_) : verify(false), index(nullptr), pulse_iterator(begin), end(end_) { }
+    TI99TapeDecoder(Pulses::Iterator begin, Pulses::Iterator end_, const State &state_) : verify(false), index(nullptr), pulse_iterator(begin), end(end_), state(state_) { }
     
     std::vector<uint8_t> decode();
+    // Read only the sync and the number of blocks.
+    uint8_t read_header();
+    // Expected length of the file in T-states, from the length of a zero bit measured in the sync. Only valid after the header has been read.
+    uint64_t file_duration() const;
+    // Where decoding stopped. The next file on the recording can be decoded from there.
+    Pulses::Iterator position() const { return pulse_iterator; }
+    bool synced() const { return state.synced; }
+    
+    // Read the second copy of each block even if the first one is good.
+    bool verify;
+    // If set, record where the sync and the copies of each block start.
+    SeekIndex *index;
+    
+    // Called after the sync and after each block.
+    std::function<void(const State &state)> checkpoint;
+    // Called for each block as soon as it is accepted, before the following blocks are read.
+    std::function<void(const Block &block)> block_callback;
+    
+    static const size_t BLOCK_SIZE;
     
 private:
     Pulses::Iterator pulse_iterator;
     Pulses::Iterator end;
 
-    uint64_t zero_length;
-    uint64_t long_pulse_threshold;
+    State state;
     
-    std::vector<uint8_t> read_block();
-    void read_block_sync();
+    void read_block(std::array<uint8_t, 64> &data, uint8_t copy);
+    void skip_block();
+    void save_checkpoint();
+    void read_block_sync(uint8_t copy);
     uint8_t read_byte();
     void read_data_mark();
-    void read_sync();
+    Pulses::Iterator read_sync();
 
+    static const uint64_t BLOCK_BITS;
+    static const uint64_t SYNC_BITS;
+    static const uint64_t SKIP_MARGIN_BITS;
     static const uint64_t SYNC_SKIP_BEGINNING;
     static const uint64_t SYNC_MINIMUM_COUNT;
 };
@@ -30,73 +30,130 @@
 
 #include "TI99TapeEncoder.h"
 
+#include <algorithm>
+
 #include "Exception.h"
+#include "Stats.h"
 
 
-uint16_t TI99TapeEncoder::ZERO_PULSE_LENGTH = 2539;
-uint16_t TI99TapeEncoder::NUMBER_OF_SYNC_PULSES = (768 * 8);
+const uint16_t TI99TapeEncoder::ZERO_PULSE_LENGTH = 2539;
+const uint16_t TI99TapeEncoder::NUMBER_OF_SYNC_PULSES = (768 * 8);
+const uint16_t TI99TapeEncoder::DEFAULT_PAUSE = 2000;
 
-TZX::GeneralizedDataBlock::SymbolDefinitions TI99TapeEncoder::pilot_symbols = {
+const TZX::GeneralizedDataBlock::SymbolDefinitions TI99TapeEncoder::pilot_symbols = {
     TZX::GeneralizedDataBlock::SymbolDefinition(0, { ZERO_PULSE_LENGTH })
 };
 
-TZX::GeneralizedDataBlock::PilotData TI99TapeEncoder::pilot_data = {
-    TZX::GeneralizedDataBlock::PilotRunLength(0, NUMBER_OF_SYNC_PULSES)
-};
-
-TZX::GeneralizedDataBlock::SymbolDefinitions TI99TapeEncoder::data_symbols = {
+const TZX::GeneralizedDataBlock::SymbolDefinitions TI99TapeEncoder::data_symbols = {
     TZX::GeneralizedDataBlock::SymbolDefinition(0, { ZERO_PULSE_LENGTH }),
     TZX::GeneralizedDataBlock::SymbolDefinition(0, { static_cast<uint16_t>(ZERO_PULSE_LENGTH / 2), static_cast<uint16_t>(ZERO_PULSE_LENGTH - (ZERO_PULSE_LENGTH / 2)) })
 };
 
+// The TI 99/4A only needs a short leader to lock onto the signal, the stock one lasts about 4.5 seconds.
+const std::unordered_map<std::string, TI99TapeEncoder::Timing> TI99TapeEncoder::Timing::profiles = {
+    { "stock", Timing(NUMBER_OF_SYNC_PULSES, DEFAULT_PAUSE) },
+    { "short-leader", Timing(64 * 8, DEFAULT_PAUSE) },
+    { "minimal-gap", Timing(64 * 8, 250) }
+};
+
+
+TI99TapeEncoder::Timing TI99TapeEncoder::Timing::by_name(const std::string &name) {
+    auto it = profiles.find(name);
+    
+    if (it == profiles.end()) {
+        throw Exception("unknown timing profile '" + name + "'");
+    }
+    
+    return it->second;
+}
+
+
 void TI99TapeEncoder::encode(std::vector<uint8_t>::const_iterator start, std::vector<uint8_t>::const_iterator end) {
-    auto length = end - start;
+    auto length = static_cast<size_t>(end - start);
     auto num_blocks = (length + 63) / 64;
     
     if (num_blocks > 255) {
         throw Exception("file too long");
     }
     
-    if (!first) {
-        // TODO: add silence between files
+    begin_file(static_cast<uint8_t>(num_blocks));
+    
+    for (size_t offset = 0; offset < length; offset += 64) {
+        add_block(&*(start + offset), std::min(length - offset, static_cast<size_t>(64)));
+    }
+    
+    end_file();
+}
+
+
+void TI99TapeEncoder::begin_file(uint8_t number_of_blocks) {
+    auto timer = Stats::Timer(Stats::ENCODE);
+    
+    if (!first && timing.pause > 0) {
+        tzx.add_pause(timing.pause);
+    }
+    
+    data.clear();
+    pulses.clear();
+    remaining_blocks = number_of_blocks;
+    
+    // Header and two copies of each block: 8 zero bytes, data mark, 64 bytes of data and checksum.
+    auto number_of_bytes = 3 + static_cast<size_t>(number_of_blocks) * 2 * 74;
+    if (use_data_block) {
+        data.reserve(number_of_bytes * 8);
+    }
+    else {
+        pulses.reserve(number_of_bytes * 16);
     }
     
     add_byte(0xff);
-    add_byte(num_blocks);
-    add_byte(num_blocks);
-    
-    for (auto i = 0; i < num_blocks; i++) {
-        auto block_end = start < end - 64 ? start + 64 : end;
-        
-        add_block(start, block_end);
-        add_block(start, block_end);
-        
-        start += 64;
+    add_byte(number_of_blocks);
+    add_byte(number_of_blocks);
+}
+
+
+void TI99TapeEncoder::add_block(const uint8_t *block, size_t length) {
+    auto timer = Stats::Timer(Stats::ENCODE);
+    
+    if (remaining_blocks == 0) {
+        throw Exception("too many blocks");
+    }
+    remaining_blocks -= 1;
+    
+    add_block_copy(block, length);
+    add_block_copy(block, length);
+}
+
+
+void TI99TapeEncoder::end_file() {
+    auto timer = Stats::Timer(Stats::ENCODE);
+    
+    if (remaining_blocks > 0) {
+        throw Exception("missing blocks");
     }
     
     if (use_data_block) {
-        tzx.add_general_data(TZX::GeneralizedDataBlock(0, pilot_symbols, pilot_data, data_symbols, static_cast<uint32_t>(data.size() * 8), data));
+        auto pilot_data = TZX::GeneralizedDataBlock::PilotData{ TZX::GeneralizedDataBlock::PilotRunLength(0, timing.leader_pulses) };
+        tzx.add_general_data(TZX::GeneralizedDataBlock(0, pilot_symbols, pilot_data, data_symbols, static_cast<uint32_t>(data.size()), data.bytes()));
     }
     else {
-        tzx.add_pure_tone(ZERO_PULSE_LENGTH, NUMBER_OF_SYNC_PULSES);
+        tzx.add_pure_tone(ZERO_PULSE_LENGTH, timing.leader_pulses);
         tzx.add_pulse_sequence(pulses);
     }
+    
+    first = false;
 }
 
 
-void TI99TapeEncoder::add_block(std::vector<uint8_t>::const_iterator start, std::vector<uint8_t>::const_iterator end) {
+void TI99TapeEncoder::add_block_copy(const uint8_t *block, size_t length) {
     auto checksum = 0;
     
     for (auto i = 0; i < 8; i++) {
         add_byte(0);
     }
     add_byte(0xff);
-    for (auto i = 0; i < 64; i++) {
-        uint8_t byte = 0;
-        if (start < end) {
-            byte = *start;
-            start++;
-        }
+    for (size_t i = 0; i < 64; i++) {
+        uint8_t byte = i < length ? block[i] : 0;
 
         add_byte(byte);
         checksum = (checksum + byte) & 0xff;
@@ -107,7 +164,7 @@ void TI99TapeEncoder::add_block(std::vector<uint8_t>::const_iterator start, std:
 
 void TI99TapeEncoder::add_byte(uint8_t byte) {
     if (use_data_block) {
-        data.push_back(byte);
+        data.append_byte_msb_first(byte);
     }
     else {
         for (size_t i = 0; i < 8; i++) {
@@ -31,36 +31,63 @@
  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "BitVector.h"
 #include "TZX.h"
 
 class TI99TapeEncoder {
 public:
-    TI99TapeEncoder(TZX &tzx_, bool use_data_block_) : tzx(tzx_), use_data_block(use_data_block_), first(true) { }
+    // Length of the leader and of the gaps between files.
+    class Timing {
+    public:
+        Timing() : Timing(NUMBER_OF_SYNC_PULSES, DEFAULT_PAUSE) { }
+        Timing(uint16_t leader_pulses_, uint16_t pause_) : leader_pulses(leader_pulses_), pause(pause_) { }
+        
+        static Timing by_name(const std::string &name);
+        
+        uint16_t leader_pulses; // zero bits before the data mark of each file
+        uint16_t pause; // silence before each file but the first, in milliseconds
+        
+    private:
+        static const std::unordered_map<std::string, Timing> profiles;
+    };
+    
+    TI99TapeEncoder(TZX &tzx_, bool use_data_block_) : tzx(tzx_), use_data_block(use_data_block_), first(true), remaining_blocks(0) { }
 
     void encode(const std::vector<uint8_t> &data) { encode(data.begin(), data.end()); }
     void encode(std::vector<uint8_t>::const_iterator start, std::vector<uint8_t>::const_iterator end);
     
+    // Encode a file block by block, as the data becomes available.
+    void begin_file(uint8_t number_of_blocks);
+    void add_block(const uint8_t *block, size_t length); // shorter blocks are padded with zeros
+    void end_file();
+    
+    Timing timing;
+    
+    static const uint16_t ZERO_PULSE_LENGTH; // in T-states at 3.5MHz
+    
 private:
-    TZX tzx;
+    TZX &tzx;
     bool use_data_block;
     bool first;
+    size_t remaining_blocks;
     
-    std::vector<uint8_t> data;
+    BitVector data;
     std::vector<uint16_t> pulses;
     
     void add_byte(uint8_t byte);
-    void add_block(std::vector<uint8_t>::const_iterator start, std::vector<uint8_t>::const_iterator end);
+    void add_block_copy(const uint8_t *block, size_t length);
     
-    static uint16_t ZERO_PULSE_LENGTH;
-    static uint16_t ONE_PULSE_LENGTH;
-    static uint16_t NUMBER_OF_SYNC_PULSES;
+    static const uint16_t NUMBER_OF_SYNC_PULSES;
+    static const uint16_t DEFAULT_PAUSE;
     
-    static TZX::GeneralizedDataBlock::SymbolDefinitions pilot_symbols;
-    static TZX::GeneralizedDataBlock::SymbolDefinitions data_symbols;
-    static TZX::GeneralizedDataBlock::PilotData pilot_data;
+    // Only read, so encoders can run on several threads at once, as long as each has its own TZX.
+    static const TZX::GeneralizedDataBlock::SymbolDefinitions pilot_symbols;
+    static const TZX::GeneralizedDataBlock::SymbolDefinitions data_symbols;
 };
 
 #endif // HAD_TI99_TAPE_ENCODER_H
@@ -33,9 +33,10 @@
 #include <algorithm>
 
 #include "Exception.h"
+#include "Trace.h"
 #include "utility.h"
 
-TZX::TZX(const std::string &filename) : file(filename) {
+TZX::TZX(const std::string &filename) : file(filename), playback_duration(0) {
     file.write_string("ZXTape!");
     file.write_8(0x1a);
     file.write_8(1);
@@ -43,7 +44,15 @@ TZX::TZX(const std::string &filename) : file(filename) {
 }
 
 
+void TZX::add_blocks(const TZX &other) {
+    auto span = Trace::Span("write TZX blocks");
+    file.write_data(other.file.contents());
+    playback_duration += other.playback_duration;
+}
+
+
 void TZX::add_general_data(const GeneralizedDataBlock &block) {
+    auto span = Trace::Span("write TZX block");
     file.write_8(0x19);
     file.write_32(block.block_length());
     file.write_16(block.pause_after);
@@ -60,10 +69,20 @@ void TZX::add_general_data(const GeneralizedDataBlock &block) {
     }
     write_symbol_definitions(block.number_of_data_symbol_pulses, block.data_symbols);
     file.write_data(block.data);
+    playback_duration += block.duration();
+}
+
+
+void TZX::add_pause(uint16_t milliseconds) {
+    auto span = Trace::Span("write TZX block");
+    file.write_8(0x20);
+    file.write_16(milliseconds);
+    playback_duration += static_cast<uint64_t>(milliseconds) * 3500;
 }
 
 
 void TZX::add_pure_data(const PureDataBlock &block) {
+    auto span = Trace::Span("write TZX block");
     file.write_8(0x14);
     file.write_16(block.zero_pulse_length);
     file.write_16(block.one_pulse_length);
@@ -71,23 +90,31 @@ void TZX::add_pure_data(const PureDataBlock &block) {
     file.write_16(block.pause_after);
     file.write_24(static_cast<uint32_t>(block.data.size()));
     file.write_data(block.data);
+    for (uint32_t i = 0; i < block.number_of_bits; i++) {
+        playback_duration += (block.data[i / 8] & (0x80 >> (i % 8))) ? 2 * block.one_pulse_length : 2 * block.zero_pulse_length;
+    }
+    playback_duration += static_cast<uint64_t>(block.pause_after) * 3500;
 }
 
 
 void TZX::add_pure_tone(uint16_t pulse_length, uint16_t repetitions) {
+    auto span = Trace::Span("write TZX block");
     file.write_8(0x12);
     file.write_16(pulse_length);
     file.write_16(repetitions);
+    playback_duration += static_cast<uint64_t>(pulse_length) * repetitions;
 }
 
 
 void TZX::add_pulse_sequence(const std::vector<uint16_t> &pulses) {
+    auto span = Trace::Span("write TZX block");
     for (size_t i = 0; i < pulses.size(); i += 255) {
         uint16_t length = std::min(static_cast<size_t>(255), pulses.size() - i);
         file.write_8(0x13);
         file.write_8(length);
         for (size_t j = i; j < i + length; j++) {
             file.write_16(pulses[j]);
+            playback_duration += pulses[j];
         }
     }
 }
@@ -103,7 +130,7 @@ void TZX::write_symbol_definitions(uint8_t number_of_pulses, const GeneralizedDa
 }
 
 
-TZX::GeneralizedDataBlock::GeneralizedDataBlock(uint16_t pause_after_, const SymbolDefinitions &pilot_symbols_, const PilotData &pilot_data_, SymbolDefinitions &data_symbols_, uint32_t data_size_, const std::vector<uint8_t> &data_) : pause_after(pause_after_), number_of_pilot_symbol_pulses(0), number_of_data_symbol_pulses(0), data_size(data_size_) {
+TZX::GeneralizedDataBlock::GeneralizedDataBlock(uint16_t pause_after_, const SymbolDefinitions &pilot_symbols_, const PilotData &pilot_data_, const SymbolDefinitions &data_symbols_, uint32_t data_size_, const std::vector<uint8_t> &data_) : pause_after(pause_after_), number_of_pilot_symbol_pulses(0), number_of_data_symbol_pulses(0), data_size(data_size_) {
     if (!pilot_data_.empty())  {
         pilot_data = pilot_data_;
         pilot_symbols = pilot_symbols_;
@@ -165,6 +192,44 @@ uint32_t TZX::GeneralizedDataBlock::block_length() const {
 }
 
 
+uint64_t TZX::GeneralizedDataBlock::duration() const {
+    auto symbol_durations = [](const SymbolDefinitions &symbols) {
+        auto durations = std::vector<uint64_t>();
+        for (const auto &symbol : symbols) {
+            uint64_t duration = 0;
+            for (auto length : symbol.pulse_lengths) {
+                duration += length;
+            }
+            durations.push_back(duration);
+        }
+        return durations;
+    };
+    
+    uint64_t duration = static_cast<uint64_t>(pause_after) * 3500;
+    
+    auto pilot_durations = symbol_durations(pilot_symbols);
+    for (const auto &entry : pilot_data) {
+        duration += pilot_durations[entry.symbol] * entry.repetitions;
+    }
+    
+    if (data_size > 0) {
+        auto data_durations = symbol_durations(data_symbols);
+        auto bits_per_symbol = number_of_bits(data_symbols.size());
+        for (uint64_t i = 0; i < data_size; i++) {
+            size_t symbol = 0;
+            for (uint64_t bit = i * bits_per_symbol; bit < (i + 1) * bits_per_symbol; bit++) {
+                symbol = (symbol << 1) | ((data[bit / 8] >> (7 - bit % 8)) & 1);
+            }
+            if (symbol < data_durations.size()) {
+                duration += data_durations[symbol];
+            }
+        }
+    }
+    
+    return duration;
+}
+
+
 TZX::PureDataBlock::PureDataBlock(uint16_t pause_after_, uint16_t zero_pulse_length_, uint16_t one_pulse_length_, uint32_t number_of_bits_, const std::vector<uint8_t> &data_) : pause_after(pause_after_), zero_pulse_length(zero_pulse_length_), one_pulse_length(one_pulse_length_), number_of_bits(number_of_bits_) {
     if (number_of_bits >= (1 << 27)) {
         throw Exception("data too long");
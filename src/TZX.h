@@ -31,6 +31,7 @@
  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstdint>
 #include <vector>
 
 #include "OutputFile.h"
@@ -58,7 +59,7 @@ public:
         typedef std::vector<SymbolDefinition> SymbolDefinitions;
         typedef std::vector<PilotRunLength> PilotData;
         
-        GeneralizedDataBlock(uint16_t paus_after, const SymbolDefinitions &pilot_symbols, const PilotData &pilot_data, SymbolDefinitions &data_symbols, uint32_t data_size, const std::vector<uint8_t> &data);
+        GeneralizedDataBlock(uint16_t paus_after, const SymbolDefinitions &pilot_symbols, const PilotData &pilot_data, const SymbolDefinitions &data_symbols, uint32_t data_size, const std::vector<uint8_t> &data);
         
         uint16_t pause_after;
 
@@ -72,6 +73,7 @@ public:
         std::vector<uint8_t> data;
 
         uint32_t block_length() const;
+        uint64_t duration() const;
 
     private:
         uint8_t get_number_of_pulses(const SymbolDefinitions &symbols) const;
@@ -89,14 +91,23 @@ public:
     };
 
     TZX(const std::string &filename);
+    // Collect blocks in memory, without the file header. They can be added to another TZX with add_blocks.
+    TZX() : playback_duration(0) { }
+    
+    // Time it takes to play back the blocks written so far, in T-states at 3.5MHz.
+    uint64_t duration() const { return playback_duration; }
+    
+    void add_blocks(const TZX &other);
     
     void add_general_data(const GeneralizedDataBlock &block);
+    void add_pause(uint16_t milliseconds);
     void add_pure_data(const PureDataBlock &block);
     void add_pure_tone(uint16_t pulse_length, uint16_t repetitions);
     void add_pulse_sequence(const std::vector<uint16_t> &pulses);
 
 private:
     OutputFile file;
+    uint64_t playback_duration;
     
     void write_symbol_definitions(uint8_t number_of_pulses, const GeneralizedDataBlock::SymbolDefinitions &symbols);
 };
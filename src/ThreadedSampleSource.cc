@@ -0,0 +1,98 @@
+/*
+ ThreadedSampleSource.cc -- read and convert samples on a separate thread.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ThreadedSampleSource.h"
+
+#include "Trace.h"
+
+const size_t ThreadedSampleSource::RING_SIZE = 16;
+const size_t ThreadedSampleSource::CHUNK_SIZE = 16384;
+
+ThreadedSampleSource::ThreadedSampleSource(std::unique_ptr<SampleSource> source_) : source(std::move(source_)), chunks(RING_SIZE) {
+    sample_rate = source->sample_rate;
+    peak = source->peak;
+    thread = std::thread(&ThreadedSampleSource::run, this);
+}
+
+
+ThreadedSampleSource::~ThreadedSampleSource() {
+    interrupt();
+    thread.join();
+}
+
+
+void ThreadedSampleSource::interrupt() {
+    chunks.close();
+    // The thread may be waiting for input that never comes, like standard input of a recording that is still running.
+    source->interrupt();
+}
+
+
+size_t ThreadedSampleSource::read(const int16_t **samples) {
+    if (!chunks.pop(current)) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return 0;
+    }
+    
+    *samples = current.data();
+    return current.size();
+}
+
+
+void ThreadedSampleSource::run() {
+    Trace::name_thread("read samples");
+    auto chunk = std::vector<int16_t>();
+    
+    try {
+        while (true) {
+            // Collect short runs into larger chunks to keep the number of hand-overs down.
+            chunk.clear();
+            chunk.reserve(CHUNK_SIZE);
+            while (chunk.size() < CHUNK_SIZE) {
+                const int16_t *run;
+                auto n = source->read(&run);
+                if (n == 0) {
+                    break;
+                }
+                chunk.insert(chunk.end(), run, run + n);
+            }
+            if (chunk.empty() || !chunks.push(chunk)) {
+                break;
+            }
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    
+    chunks.close();
+}
@@ -0,0 +1,65 @@
+/*
+ ThreadedSampleSource.h -- read and convert samples on a separate thread.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HAD_THREADED_SAMPLE_SOURCE_H
+#define HAD_THREADED_SAMPLE_SOURCE_H
+
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Ring.h"
+#include "SampleSource.h"
+
+// Runs another sample source on its own thread, reading ahead into a bounded ring of sample chunks.
+class ThreadedSampleSource : public SampleSource {
+public:
+    explicit ThreadedSampleSource(std::unique_ptr<SampleSource> source);
+    ThreadedSampleSource(const ThreadedSampleSource &other) = delete;
+    ~ThreadedSampleSource();
+    
+    size_t read(const int16_t **samples) override;
+    void interrupt() override;
+    
+private:
+    std::unique_ptr<SampleSource> source;
+    Ring<std::vector<int16_t>> chunks;
+    std::vector<int16_t> current;
+    std::exception_ptr error; // written by the thread before closing the ring
+    std::thread thread;
+    
+    void run();
+    
+    static const size_t RING_SIZE;
+    static const size_t CHUNK_SIZE;
+};
+
+#endif // HAD_THREADED_SAMPLE_SOURCE_H
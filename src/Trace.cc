@@ -0,0 +1,119 @@
+/*
+ Trace.cc -- record timeline in Chrome trace event format.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Trace.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+#include "Exception.h"
+
+const int64_t Trace::NO_ARGUMENT = -1;
+const size_t Trace::INITIAL_BUFFER_SIZE = 16384;
+
+std::atomic<bool> Trace::active;
+std::string Trace::filename;
+uint64_t Trace::start_time;
+
+std::mutex Trace::buffers_mutex;
+std::vector<std::unique_ptr<Trace::ThreadBuffer>> Trace::buffers;
+thread_local Trace::ThreadBuffer *Trace::thread_buffer = nullptr;
+
+
+void Trace::open(const std::string &filename_) {
+    filename = filename_;
+    start_time = now();
+    name_thread("main");
+    active = true;
+}
+
+
+void Trace::close() {
+    if (!active) {
+        return;
+    }
+    active = false;
+    
+    auto f = fopen(filename.c_str(), "w");
+    if (f == nullptr) {
+        throw Exception("can't create trace file '" + filename + "'");
+    }
+    
+    auto lock = std::lock_guard<std::mutex>(buffers_mutex);
+    auto first = true;
+    
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (const auto &buffer : buffers) {
+        if (!buffer->name.empty()) {
+            fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %" PRIu64 ", \"args\": {\"name\": \"%s\"}}", first ? "" : ",\n", buffer->id, buffer->name.c_str());
+            first = false;
+        }
+        for (const auto &event : buffer->events) {
+            fprintf(f, "%s{\"name\": \"%s\", \"cat\": \"ti99tape\", \"ph\": \"X\", \"pid\": 1, \"tid\": %" PRIu64 ", \"ts\": %.3f, \"dur\": %.3f", first ? "" : ",\n", event.name, buffer->id, (event.start - start_time) / 1e3, event.duration / 1e3);
+            if (event.argument != NO_ARGUMENT) {
+                fprintf(f, ", \"args\": {\"index\": %" PRId64 "}", event.argument);
+            }
+            fputs("}", f);
+            first = false;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    
+    if (fclose(f) != 0) {
+        throw Exception("can't write trace file '" + filename + "'");
+    }
+}
+
+
+void Trace::name_thread(const std::string &name) {
+    get_thread_buffer()->name = name;
+}
+
+
+Trace::ThreadBuffer *Trace::get_thread_buffer() {
+    if (thread_buffer == nullptr) {
+        auto lock = std::lock_guard<std::mutex>(buffers_mutex);
+        buffers.push_back(std::make_unique<ThreadBuffer>(buffers.size() + 1));
+        thread_buffer = buffers.back().get();
+    }
+    
+    return thread_buffer;
+}
+
+
+uint64_t Trace::now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+void Trace::record(const char *name, uint64_t start, uint64_t duration, int64_t argument) {
+    get_thread_buffer()->events.emplace_back(name, start, duration, argument);
+}
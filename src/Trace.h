@@ -0,0 +1,100 @@
+#ifndef HAD_TRACE_H
+#define HAD_TRACE_H
+
+/*
+ Trace.h -- record timeline in Chrome trace event format.
+ Copyright (C) 2021 Dieter Baron
+ 
+ This file is part of ti99tape, a utility to create TZX files
+ for TI 99/4A tape images.
+ The authors can be contacted at <ti99tape@tpau.group>
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+ 1. Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 2. The names of the authors may not be used to endorse or promote
+ products derived from this software without specific prior
+ written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+ OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Trace {
+public:
+    // Records the time from construction to destruction as a complete event, if tracing is enabled.
+    class Span {
+    public:
+        explicit Span(const char *name_, int64_t argument_ = NO_ARGUMENT) : name(name_), argument(argument_), start(enabled() ? now() : 0) { }
+        Span(const Span &other) = delete;
+        ~Span() { if (start != 0) { record(name, start, now() - start, argument); } }
+        
+    private:
+        const char *name;
+        int64_t argument;
+        uint64_t start;
+    };
+
+    static void open(const std::string &filename);
+    static void close();
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+    
+    static void name_thread(const std::string &name);
+    
+    static const int64_t NO_ARGUMENT;
+
+private:
+    class Event {
+    public:
+        Event(const char *name_, uint64_t start_, uint64_t duration_, int64_t argument_) : name(name_), start(start_), duration(duration_), argument(argument_) { }
+        
+        const char *name;
+        uint64_t start;
+        uint64_t duration;
+        int64_t argument;
+    };
+    
+    // Only the owning thread appends to a buffer, so recording needs no locking. Buffers are written out after all threads are done.
+    class ThreadBuffer {
+    public:
+        ThreadBuffer(uint64_t id_) : id(id_) { events.reserve(INITIAL_BUFFER_SIZE); }
+        
+        uint64_t id;
+        std::string name;
+        std::vector<Event> events;
+    };
+    
+    static std::atomic<bool> active;
+    static std::string filename;
+    static uint64_t start_time;
+    
+    static std::mutex buffers_mutex;
+    static std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    static thread_local ThreadBuffer *thread_buffer;
+    
+    static ThreadBuffer *get_thread_buffer();
+    static uint64_t now();
+    static void record(const char *name, uint64_t start, uint64_t duration, int64_t argument);
+    
+    static const size_t INITIAL_BUFFER_SIZE;
+};
+
+#endif // HAD_TRACE_H
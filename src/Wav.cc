@@ -30,105 +30,258 @@
 
 #include "Wav.h"
 
-#include "Buffer.h"
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+
 #include "Exception.h"
+#include "MappedFile.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "utility.h"
+
+const uint16_t Wav::FORMAT_PCM = 1;
+const uint16_t Wav::FORMAT_FLOAT = 3;
+const uint16_t Wav::FORMAT_EXTENSIBLE = 0xfffe;
+
+// KSDATAFORMAT_SUBTYPE_* GUIDs, after the format tag in the first two bytes.
+const std::string Wav::extensible_guid_suffix = std::string("\x00\x00\x00\x00\x10\x00\x80\x00\x00\xaa\x00\x38\x9b\x71", 14);
 
-Wav::Wav(const std::vector<uint8_t> &data, Mixdown mixdown) {
-    auto buffer = Buffer(data);
+const size_t Wav::RUN_LENGTH = 65536;
+const size_t Wav::HEADER_LENGTH = 65536;
+const uint64_t Wav::UNKNOWN_LENGTH = UINT64_MAX;
+
+Wav::Wav(const uint8_t *data, size_t length, Mixdown mixdown_) : mixdown(mixdown_), frames(nullptr), num_frames(0), position(0), output(RUN_LENGTH) {
+    auto timer = Stats::Timer(Stats::CONVERT);
+    auto span = Trace::Span("parse WAV");
+    auto buffer = Buffer(data, length);
     
     auto magic = buffer.get_string(4);
-    if (magic != "RIFF") {
-        printf("magic: %s\n", magic.c_str());
-        throw Exception("not a WAV file");
+    auto is_rf64 = magic == "RF64" || magic == "BW64";
+    if (magic != "RIFF" && !is_rf64) {
+        throw Exception("not a WAV file (unknown magic '" + magic + "')");
     }
     
-    auto size = buffer.get_uint32();
+    uint64_t size = buffer.get_uint32();
     
     magic = buffer.get_string(4);
     if (magic != "WAVE") {
-        printf("format: %s\n", magic.c_str());
-        throw Exception("not a WAV file");
+        throw Exception("not a WAV file (unknown format '" + magic + "')");
     }
     
-    auto chunks = buffer.get_buffer(size - 4);
+    auto chunk_sizes = std::unordered_map<std::string, uint64_t>();
+    if (is_rf64) {
+        // The ds64 chunk must come first, it holds the sizes that don't fit into 32 bits.
+        auto header = buffer;
+        if (header.get_string(4) != "ds64") {
+            throw Exception("missing ds64 chunk");
+        }
+        auto ds64 = header.get_buffer(header.get_uint32());
+        auto riff_size = ds64.get_uint64();
+        chunk_sizes["data"] = ds64.get_uint64();
+        ds64.skip(8); // sample count
+        auto table_length = ds64.get_uint32();
+        for (uint32_t i = 0; i < table_length; i++) {
+            auto id = ds64.get_string(4);
+            chunk_sizes[id] = ds64.get_uint64();
+        }
+        if (size == UINT32_MAX) {
+            size = riff_size;
+        }
+    }
     
-    uint16_t channels = 0;
-    uint16_t sample_size = 0;
+    if (size < 4) {
+        throw Exception("invalid RIFF size");
+    }
+    auto chunks = buffer.get_buffer(size - 4);
     
     while (!chunks.at_end()) {
         auto id = chunks.get_string(4);
-        auto chunk_size = chunks.get_uint32();
+        uint64_t chunk_size = chunks.get_uint32();
+        if (is_rf64 && chunk_size == UINT32_MAX) {
+            auto it = chunk_sizes.find(id);
+            if (it != chunk_sizes.end()) {
+                chunk_size = it->second;
+            }
+        }
         auto chunk_data = chunks.get_buffer(chunk_size);
+        if (chunk_size % 2 == 1 && !chunks.at_end()) {
+            chunks.skip(1); // padding
+        }
         
         if (id == "fmt ") {
-            if (chunk_data.get_uint16() != 1) {
-                throw Exception("not a PCM WAV file");
-            }
-            channels = chunk_data.get_uint16();
-            sample_rate = chunk_data.get_uint32();
-            chunk_data.skip(6); // byte rate and block align
-            sample_size = chunk_data.get_uint16();
-            
-            if (sample_size != 8 && sample_size != 16) {
-                throw Exception("unsupported sample size");
-            }
-            sample_size /= 8;
-            if (channels != 1 && channels != 2) {
-                throw Exception("unsupported number of channels");
-            }
+            format = parse_format(chunk_data, sample_rate);
         }
         else if (id == "data") {
-            if (channels == 0) {
+            if (!format.has_value()) {
                 throw Exception("missing fmt chunk");
             }
             
-            auto num_samples = chunk_size / (channels * sample_size);
+            num_frames = chunk_size / format->frame_size();
+            frames = chunk_data.get_data(num_frames * format->frame_size());
             
-            if (channels == 1) {
+            if (format->channels == 1) {
                 mixdown = LEFT;
             }
-            peek = 0;
-            samples.resize(num_samples);
             
-            for (size_t i = 0; i < num_samples; i++) {
-                switch (mixdown) {
-                    case RIGHT:
-                        if (channels == 2) {
-                            chunk_data.skip(sample_size);
-                        }
-                        // fallthrough
-                    case LEFT:
-                        switch (sample_size) {
-                            case 1: {
-                                uint8_t sample8 = chunk_data.get_uint8();
-                                samples[i] = (static_cast<int16_t>(sample8) * 0x101) - 0x8000;
-                                break;
-                            }
-                            case 2:
-                                samples[i] = chunk_data.get_int16();
-                                break;
-                        }
-                        if (mixdown == LEFT && channels == 2) {
-                            chunk_data.skip(sample_size);
-                        }
-                        break;
-                        
-                    case BOTH:
-                        switch (sample_size) {
-                            case 1:
-                                samples[i] = (static_cast<int16_t>(chunk_data.get_uint8()) + static_cast<int16_t>(chunk_data.get_uint8()) * 0x80) - 0x8000;
-                                break;
-                            case 2:
-                                samples[i] = (chunk_data.get_int16() + chunk_data.get_int16()) / 2;
-                                break;
-                        }
-                        break;
-                }
-                
-                if (abs(samples[i]) > peek) {
-                    peek = abs(samples[i]);
+            int32_t maximum = 0;
+            for (size_t start = 0; start < num_frames; start += RUN_LENGTH) {
+                auto n = std::min(RUN_LENGTH, num_frames - start);
+                convert(frames + start * format->frame_size(), n, output.data());
+                for (size_t i = 0; i < n; i++) {
+                    maximum = std::max(maximum, std::abs(static_cast<int32_t>(output[i])));
                 }
             }
+            peak = static_cast<int16_t>(std::min(maximum, static_cast<int32_t>(INT16_MAX)));
+        }
+    }
+}
+
+
+size_t Wav::read(const int16_t **run) {
+    auto n = std::min(RUN_LENGTH, num_frames - position);
+    if (n == 0) {
+        return 0;
+    }
+    
+    auto timer = Stats::Timer(Stats::CONVERT);
+    convert(frames + position * format->frame_size(), n, output.data());
+    position += n;
+    
+    *run = output.data();
+    return n;
+}
+
+
+void Wav::convert(const uint8_t *data, size_t n, int16_t *samples) const {
+    switch (mixdown) {
+        case LEFT:
+            format->convert(data, n, 0, samples);
+            break;
+        case RIGHT:
+            format->convert(data, n, 1, samples);
+            break;
+        case BOTH:
+            format->mix(data, n, samples);
+            break;
+    }
+}
+
+
+Wav::Header Wav::parse_header(const uint8_t *data, size_t length) {
+    auto buffer = Buffer(data, length);
+    
+    auto magic = buffer.get_string(4);
+    if (magic != "RIFF" && magic != "RF64" && magic != "BW64") {
+        throw Exception("not a WAV file (unknown magic '" + magic + "')");
+    }
+    buffer.skip(4);
+    magic = buffer.get_string(4);
+    if (magic != "WAVE") {
+        throw Exception("not a WAV file (unknown format '" + magic + "')");
+    }
+    
+    auto format = std::optional<SampleFormat>();
+    auto sample_rate = 0;
+    auto data_length = UNKNOWN_LENGTH;
+    
+    while (!buffer.at_end()) {
+        auto id = buffer.get_string(4);
+        uint64_t chunk_size = buffer.get_uint32();
+        
+        if (id == "data") {
+            if (!format.has_value()) {
+                throw Exception("missing fmt chunk");
+            }
+            if (chunk_size != UINT32_MAX) {
+                // Otherwise the size is in the ds64 chunk, or not known yet while recording.
+                data_length = chunk_size;
+            }
+            return Header(*format, sample_rate, buffer.position(), data_length);
+        }
+        
+        auto chunk_data = buffer.get_buffer(chunk_size);
+        if (chunk_size % 2 == 1 && !buffer.at_end()) {
+            buffer.skip(1); // padding
         }
+        if (id == "fmt ") {
+            format = parse_format(chunk_data, sample_rate);
+        }
+        else if (id == "ds64") {
+            chunk_data.skip(8); // RIFF size
+            data_length = chunk_data.get_uint64();
+        }
+    }
+    
+    throw Exception("missing data chunk");
+}
+
+
+Wav::Header Wav::read_header(const std::string &filename) {
+    auto prefix = get_file_part(filename, 0, HEADER_LENGTH);
+    
+    try {
+        return parse_header(prefix.data(), prefix.size());
+    }
+    catch (Exception &) {
+        if (prefix.size() < HEADER_LENGTH) {
+            throw;
+        }
+    }
+    
+    // Chunks before the sample data don't fit into the prefix.
+    auto input = MappedFile(filename);
+    return parse_header(input.data(), input.size());
+}
+
+
+SampleFormat Wav::parse_format(Buffer &buffer, int &sample_rate) {
+    auto format_tag = buffer.get_uint16();
+    auto channels = buffer.get_uint16();
+    sample_rate = static_cast<int>(buffer.get_uint32());
+    buffer.skip(6); // byte rate and block align
+    auto sample_size = buffer.get_uint16();
+    
+    if (format_tag == FORMAT_EXTENSIBLE) {
+        if (buffer.get_uint16() < 22) {
+            throw Exception("invalid extensible fmt chunk");
+        }
+        buffer.skip(6); // valid bits per sample and channel mask
+        format_tag = buffer.get_uint16();
+        if (buffer.get_string(14) != extensible_guid_suffix) {
+            throw Exception("unsupported WAV sub format");
+        }
+    }
+    
+    if (channels == 0) {
+        throw Exception("unsupported number of channels");
+    }
+    if (sample_rate <= 0) {
+        throw Exception("invalid sample rate");
+    }
+    
+    switch (format_tag) {
+        case FORMAT_PCM:
+            switch (sample_size) {
+                case 8:
+                    return SampleFormat(SampleFormat::UNSIGNED_8, channels);
+                case 16:
+                    return SampleFormat(SampleFormat::SIGNED_16, channels);
+                case 24:
+                    return SampleFormat(SampleFormat::SIGNED_24, channels);
+                case 32:
+                    return SampleFormat(SampleFormat::SIGNED_32, channels);
+                default:
+                    throw Exception("unsupported sample size");
+            }
+            
+        case FORMAT_FLOAT:
+            if (sample_size != 32) {
+                throw Exception("unsupported sample size");
+            }
+            return SampleFormat(SampleFormat::FLOAT_32, channels);
+            
+        default:
+            throw Exception("not a PCM WAV file");
     }
 }
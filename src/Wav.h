@@ -31,23 +31,58 @@
  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstdint>
+#include <optional>
 #include <string>
 #include <vector>
 
-class Wav {
+#include "Buffer.h"
+#include "SampleFormat.h"
+#include "SampleSource.h"
+
+// Samples are converted as they are read, from data owned by the caller, which must outlive the Wav.
+class Wav : public SampleSource {
 public:
-    enum Mixdown {
-        LEFT,
-        BOTH,
-        RIGHT
+    class Header {
+    public:
+        Header(SampleFormat format_, int sample_rate_, uint64_t data_offset_, uint64_t data_length_) : format(format_), sample_rate(sample_rate_), data_offset(data_offset_), data_length(data_length_) { }
+        
+        SampleFormat format;
+        int sample_rate;
+        uint64_t data_offset;
+        uint64_t data_length; // in bytes, as given in the data chunk header, UNKNOWN_LENGTH if it isn't known
     };
-    Wav(const std::vector<uint8_t> &data, Mixdown mixdown);
     
-    int sample_rate;
-    int16_t peek;
-    std::vector<int16_t> samples;
+    Wav(const std::vector<uint8_t> &data, Mixdown mixdown) : Wav(data.data(), data.size(), mixdown) { }
+    Wav(const uint8_t *data, size_t length, Mixdown mixdown);
+    
+    size_t read(const int16_t **samples) override;
+    
+    // Find the sample data of a file that may still be written to, ignoring the size in the RIFF header.
+    static Header parse_header(const uint8_t *data, size_t length);
+    // Like parse_header, reading only the start of the file if the header fits into it.
+    static Header read_header(const std::string &filename);
     
+    static const uint64_t UNKNOWN_LENGTH;
+    
+private:
+    std::optional<SampleFormat> format;
+    Mixdown mixdown;
+    const uint8_t *frames;
+    size_t num_frames;
+    size_t position;
+    std::vector<int16_t> output;
+    
+    void convert(const uint8_t *data, size_t n, int16_t *samples) const;
+
+    static SampleFormat parse_format(Buffer &buffer, int &sample_rate);
     
+    static const uint16_t FORMAT_PCM;
+    static const uint16_t FORMAT_FLOAT;
+    static const uint16_t FORMAT_EXTENSIBLE;
+    static const std::string extensible_guid_suffix;
+    static const size_t RUN_LENGTH;
+    static const size_t HEADER_LENGTH;
 };
 
 #endif // HAD_WAV_H
@@ -28,30 +28,106 @@
  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <atomic>
+#include <cinttypes>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <thread>
 
+#include "ChannelSplitter.h"
 #include "Exception.h"
 #include "FileFormat.h"
+#include "Flac.h"
 #include "GetOpt.h"
+#include "LeaderScanner.h"
+#include "MappedFile.h"
+#include "PcmStream.h"
+#include "ResultCache.h"
+#include "PulseEncoder.h"
 #include "Pulses.h"
+#include "SeekIndex.h"
+#include "Stats.h"
 #include "System.h"
 #include "TI99TapeDecoder.h"
 #include "TI99TapeEncoder.h"
+#include "ThreadedSampleSource.h"
+#include "Trace.h"
 #include "TZX.h"
 #include "utility.h"
 #include "Wav.h"
 
 #define T_LENGTH 3500000
 
-static void convert(System::Type system, FileFormat::Type input_format, FileFormat::Type output_format, const std::vector<uint8_t> &contents, const std::string &outfile);
+static bool verbose = false;
+static bool follow = false;
+static bool pipeline = false;
+static bool bit_planes = false;
+static bool verify = false;
+static bool all_files = false;
+static bool compact = false;
+static bool split_channels = false;
+static TI99TapeEncoder::Timing timing;
+static std::optional<std::string> checkpoint_file;
+static TI99TapeDecoder::State resume_state;
+// Recording opened by open_stream, identified in checkpoints and the seek index.
+static std::string stream_input;
+static uint64_t stream_data_offset = 0;
+static bool started_from_index = false;
+static std::unique_ptr<ResultCache> cache;
+static std::optional<std::string> index_recording;
+static std::optional<SeekIndex> seek_index; // from a previous run
+static std::unique_ptr<SeekIndex> new_index; // built during this run
+static std::optional<std::string> start_time;
+static std::optional<std::string> end_time;
+static uint32_t file_number = 0; // file to decode, counted from 0 starting at --start
+static uint32_t files_to_skip = 0; // files before it that are still to be read
+
+static void convert_file(System::Type system, FileFormat::Type output_format, const std::string &infile, const std::string &outfile);
+static void convert(System::Type system, FileFormat::Type input_format, FileFormat::Type output_format, const MappedFile &input, const std::string &outfile);
+static bool convert_samples(System::Type system, FileFormat::Type output_format, std::unique_ptr<SampleSource> source, const std::string &outfile);
+static bool convert_pulses(System::Type system, FileFormat::Type output_format, Pulses &pulses, const std::string &outfile);
 static void convert_wav(Pulses &pulses, TZX &tzx);
+static std::vector<uint8_t> decode_ti(Pulses &pulses, std::function<void(const TI99TapeDecoder::Block &block)> block_callback = nullptr);
+static std::vector<uint8_t> decode_ti(Pulses::Iterator &position, Pulses::Iterator end, const TI99TapeDecoder::State &state, std::function<void(const TI99TapeDecoder::Block &block)> block_callback, bool &synced);
+static void decode_all_ti(Pulses &pulses, std::function<void(size_t index, const std::vector<uint8_t> &data)> file_callback);
+static std::string numbered_filename(const std::string &filename, size_t number);
 static void encode_ti(std::vector<uint8_t>::const_iterator begin, std::vector<uint8_t>::const_iterator end, TZX &tzx);
+static std::unique_ptr<PcmStream> open_stream(const std::string &filename, SampleFormat format, int sample_rate, uint64_t data_offset, uint64_t data_length);
+static void seek_to_sync(uint64_t start);
+static bool convert_stream(System::Type system, FileFormat::Type output_format, const std::string &filename, SampleFormat format, int sample_rate, uint64_t data_offset, uint64_t data_length, const std::string &outfile);
+static void scan_recording(const std::string &filename, SampleFormat format, int sample_rate, uint64_t data_offset, uint64_t data_length);
+static void encode_compilation(System::Type system, FileFormat::Type output_format, const std::vector<std::string> &infiles, const std::string &outfile);
+static void report_duration(const TZX &tzx);
+static void decode_channels(System::Type system, FileFormat::Type output_format, std::unique_ptr<PcmStream> stream, const std::string &outfile);
 
 int main(int argc, const char * argv[]) {
     auto options = GetOpt({
+        GetOpt::Option('a', "all", "decode all files on the recording"),
+        GetOpt::Option("bit-planes", "detect pulses on packed comparator bit planes"),
+        GetOpt::Option("cache", GetOpt::ARGUMENT_REQUIRED, "directory", "reuse results of previous conversions stored in directory"),
+        GetOpt::Option("cache-size", GetOpt::ARGUMENT_REQUIRED, "megabytes", "maximum size of cache", "256"),
+        GetOpt::Option("checkpoint", GetOpt::ARGUMENT_REQUIRED, "file", "save decoding progress to file and resume from it"),
+        GetOpt::Option('c', "channels", GetOpt::ARGUMENT_REQUIRED, "n", "number of channels in raw PCM input", "1"),
+        GetOpt::Option("compact", "encode pulses of unknown tapes as symbols, with approximate lengths"),
+        GetOpt::Option("end", GetOpt::ARGUMENT_REQUIRED, "time", "stop reading input at time (seconds, [hh:]mm:ss, or samples followed by 'smp')"),
         GetOpt::Option('F', "format", GetOpt::ARGUMENT_REQUIRED, "format", "specify output format"),
+        GetOpt::Option("file", GetOpt::ARGUMENT_REQUIRED, "n", "decode the n-th file on the recording, counted from --start", "1"),
+        GetOpt::Option("index", "keep a seek index next to the input and use it to skip to the sync"),
+        GetOpt::Option("pause", GetOpt::ARGUMENT_REQUIRED, "milliseconds", "pause between files in TZX output, overrides timing profile"),
+        GetOpt::Option("pipeline", "read, detect pulses and decode on separate threads"),
+        GetOpt::Option('r', "sample-rate", GetOpt::ARGUMENT_REQUIRED, "rate", "read input as raw PCM with given sample rate"),
+        GetOpt::Option("scan", "list the files on the recording without decoding them"),
+        GetOpt::Option("sample-format", GetOpt::ARGUMENT_REQUIRED, "format", "sample format of raw PCM input (u8, s8, s16, s24, s32, float)", "s16"),
+        GetOpt::Option("start", GetOpt::ARGUMENT_REQUIRED, "time", "start reading input at time (seconds, [hh:]mm:ss, or samples followed by 'smp')"),
+        GetOpt::Option("split-channels", "decode each channel of the input separately, writing one numbered output file per channel"),
         GetOpt::Option('s', "system", GetOpt::ARGUMENT_REQUIRED, "system", "specify computer system"),
+        GetOpt::Option("timing", GetOpt::ARGUMENT_REQUIRED, "profile", "leader and pause lengths in TZX output (stock, short-leader, minimal-gap)", "stock"),
+        GetOpt::Option("verify", "read both copies of each block"),
+        GetOpt::Option('v', "verbose", "print problems found in audio data"),
+        GetOpt::Option("stats", "print timing and counters as JSON"),
+        GetOpt::Option("trace", GetOpt::ARGUMENT_REQUIRED, "file", "write timeline in Chrome trace event format to file"),
+        GetOpt::Option('f', "follow", "keep reading input while it is being recorded"),
         GetOpt::Option('h', "help", "display this help message and exit")
     }, "ti99tape by Dieter Baron", "Report bugs to ti99tape@tpau.group");
     
@@ -62,14 +138,23 @@ int main(int argc, const char * argv[]) {
         exit(0);
     }
     
-    if (options.arguments.size() != 2) {
+    auto scan = options.is_set("scan");
+    
+    if (scan ? options.arguments.size() != 1 : options.arguments.size() < 2) {
         options.print_usage(true);
         exit(1);
     }
     
+    verbose = options.is_set("verbose");
+    
     try {
+        auto trace_file = options.option("trace");
+        if (trace_file.has_value()) {
+            Trace::open(trace_file.value());
+        }
+
         std::string infile = options.arguments[0];
-        std::string outfile = options.arguments[1];
+        std::string outfile = scan ? "" : options.arguments.back();
         
         auto output_format = FileFormat::UNKNOWN;
         auto output_format_name = options.option("format");
@@ -82,6 +167,9 @@ int main(int argc, const char * argv[]) {
         if (output_format == FileFormat::WAV) {
             throw Exception("Writing WAV files is not supported.");
         }
+        if (output_format == FileFormat::FLAC) {
+            throw Exception("Writing FLAC files is not supported.");
+        }
         if (output_format == FileFormat::TI_TAPE) {
             throw Exception("Writing TI-Tape files is not supported.");
         }
@@ -94,44 +182,175 @@ int main(int argc, const char * argv[]) {
 
         // TODO: check that output_format / system combination is valid
         
-        auto data = get_file_contents(infile);
-        
-        auto input_format = FileFormat::by_contents(data, system);
-        
-        if (input_format == FileFormat::TZX) {
-            throw Exception("reading TZX files not supported yet");
+        follow = options.is_set("follow");
+        pipeline = options.is_set("pipeline");
+        bit_planes = options.is_set("bit-planes");
+        verify = options.is_set("verify");
+        all_files = options.is_set("all");
+        compact = options.is_set("compact");
+        split_channels = options.is_set("split-channels");
+        auto timing_option = options.option("timing");
+        if (timing_option.has_value()) {
+            timing = TI99TapeEncoder::Timing::by_name(timing_option.value());
+        }
+        auto pause_option = options.option("pause");
+        if (pause_option.has_value()) {
+            auto value = parse_number(pause_option.value(), "pause");
+            if (value > UINT16_MAX) {
+                throw Exception("pause too long");
+            }
+            timing.pause = static_cast<uint16_t>(value);
+        }
+        checkpoint_file = options.option("checkpoint");
+        start_time = options.option("start");
+        end_time = options.option("end");
+        auto file_option = parse_number(options.option("file").value_or("1"), "file number");
+        if (file_option < 1 || file_option > UINT32_MAX) {
+            throw Exception("invalid file number");
+        }
+        file_number = static_cast<uint32_t>(file_option - 1);
+        files_to_skip = file_number;
+        if (all_files && checkpoint_file.has_value()) {
+            throw Exception("checkpoints are not supported when decoding all files");
+        }
+        if (file_number > 0 && (all_files || scan)) {
+            throw Exception("selecting a file is not supported when decoding all files or scanning");
+        }
+        if (split_channels && (checkpoint_file.has_value() || options.is_set("index") || scan)) {
+            throw Exception("checkpoints, seek index and scanning are not supported when splitting channels");
+        }
+        auto cache_directory = options.option("cache");
+        if (cache_directory.has_value() && !all_files && !split_channels) {
+            // The results of --all and --split-channels are spread over several files, so they aren't cached.
+            cache = std::make_unique<ResultCache>(cache_directory.value(), parse_number(options.option("cache-size").value_or("256"), "cache size") * 1024 * 1024);
+        }
+        if (checkpoint_file.has_value() && std::filesystem::exists(checkpoint_file.value())) {
+            resume_state = TI99TapeDecoder::State::load(checkpoint_file.value());
+        }
+        if (options.is_set("index") && infile != "-") {
+            index_recording = infile;
+            auto index_file = SeekIndex::filename(infile);
+            if (std::filesystem::exists(index_file)) {
+                seek_index = SeekIndex::load(index_file);
+            }
         }
         
-        convert(system, input_format, output_format, data, outfile);
-
-     }
+        auto sample_rate = options.option("sample-rate");
+        if (options.arguments.size() > 2) {
+            encode_compilation(system, output_format, std::vector<std::string>(options.arguments.begin(), options.arguments.end() - 1), outfile);
+        }
+        else if (sample_rate.has_value() || infile == "-") {
+            if (!sample_rate.has_value()) {
+                throw Exception("sample rate required for raw PCM input");
+            }
+            auto channels = parse_number(options.option("channels").value_or("1"), "number of channels");
+            auto encoding = SampleFormat::encoding_by_name(options.option("sample-format").value_or("s16"));
+            auto format = SampleFormat(encoding, channels);
+            auto rate = static_cast<int>(parse_number(sample_rate.value(), "sample rate"));
+            if (scan) {
+                scan_recording(infile, format, rate, 0, Wav::UNKNOWN_LENGTH);
+            }
+            else if (split_channels) {
+                decode_channels(system, output_format, open_stream(infile, format, rate, 0, Wav::UNKNOWN_LENGTH), outfile);
+            }
+            else if (!convert_stream(system, output_format, infile, format, rate, 0, Wav::UNKNOWN_LENGTH, outfile)) {
+                throw Exception("cannot convert " + System::name(system) + " raw PCM to " + FileFormat::name(output_format));
+            }
+        }
+        else if (scan) {
+            auto header = Wav::read_header(infile);
+            scan_recording(infile, header.format, header.sample_rate, header.data_offset, header.data_length);
+        }
+        else {
+            convert_file(system, output_format, infile, outfile);
+        }
+    }
     catch (std::exception &e) {
         fprintf(stderr, "ERROR: %s\n", e.what());
     }
+    
+    try {
+        Trace::close();
+    }
+    catch (std::exception &e) {
+        fprintf(stderr, "ERROR: %s\n", e.what());
+    }
+    
+    if (options.is_set("stats")) {
+        Stats::write_json(stdout);
+    }
 }
 
 
 static void convert_wav(Pulses &pulses, TZX &tzx) {
-    std::vector<uint16_t> data;
+    auto encoder = PulseEncoder(tzx, compact);
 
     for (auto pulse : pulses) {
         switch (pulse.type) {
             case Pulse::SILENCE:
-                // TODO: add silence block
+                encoder.add_silence(pulse.duration);
                 break;
         
             case Pulse::POSITIVE:
             case Pulse::NEGATIVE:
-                data.push_back(pulse.duration);
+                encoder.add_pulse(pulse.duration);
                 break;
         }
     }
     
-    tzx.add_pulse_sequence(data);
+    encoder.end();
+}
+
+
+static void convert_file(System::Type system, FileFormat::Type output_format, const std::string &infile, const std::string &outfile) {
+    // Only look at the start of the file, so the reader for the format can decide how to access it.
+    auto input_format = FileFormat::by_file(infile, system);
+    
+    if (input_format == FileFormat::TZX) {
+        throw Exception("reading TZX files not supported yet");
+    }
+    
+    if (input_format == FileFormat::WAV && (follow || split_channels || checkpoint_file.has_value() || index_recording.has_value() || start_time.has_value() || end_time.has_value())) {
+        // Read samples from the file as they are needed, starting where a previous run left off.
+        auto header = Wav::read_header(infile);
+        if (split_channels) {
+            decode_channels(system, output_format, open_stream(infile, header.format, header.sample_rate, header.data_offset, header.data_length), outfile);
+        }
+        else if (!convert_stream(system, output_format, infile, header.format, header.sample_rate, header.data_offset, header.data_length, outfile)) {
+            throw Exception("cannot convert " + System::name(system) + " " + FileFormat::name(input_format) + " to " + FileFormat::name(output_format));
+        }
+        return;
+    }
+    if (follow || split_channels || checkpoint_file.has_value() || index_recording.has_value() || start_time.has_value() || end_time.has_value()) {
+        throw Exception("following, resuming, seek index, time ranges and splitting channels are only supported for WAV and raw PCM input");
+    }
+    
+    auto input = MappedFile(infile);
+    
+    auto cache_key = std::string();
+    if (cache) {
+        // Everything that influences the result, including settings that can't be changed yet.
+        auto parameters = "system=" + System::name(system) + "\ninput=" + FileFormat::name(input_format) + "\noutput=" + FileFormat::name(output_format) + "\nchannel=right\nencoding=" + (compact ? "symbols" : "pulses") + "\nverify=" + (verify ? "yes" : "no") + "\nleader=" + std::to_string(timing.leader_pulses) + "\npause=" + std::to_string(timing.pause) + "\nfile=" + std::to_string(file_number) + "\n";
+        cache_key = ResultCache::key(input.data(), input.size(), parameters);
+        auto result = cache->get(cache_key);
+        if (result.has_value()) {
+            if (verbose) {
+                fprintf(stderr, "using cached result\n");
+            }
+            write_file(outfile, result.value());
+            return;
+        }
+    }
+    
+    convert(system, input_format, output_format, input, outfile);
+    
+    if (cache) {
+        cache->put(cache_key, get_file_contents(outfile));
+    }
 }
 
 
-static void convert(System::Type system, FileFormat::Type input_format, FileFormat::Type output_format, const std::vector<uint8_t> &data, const std::string &outfile) {
+static void convert(System::Type system, FileFormat::Type input_format, FileFormat::Type output_format, const MappedFile &input, const std::string &outfile) {
     // TODO: check that input_format / output_format / system combination is valid
     
     switch (input_format) {
@@ -142,9 +361,11 @@ static void convert(System::Type system, FileFormat::Type input_format, FileForm
                     auto tzx = TZX(outfile);
                     
                     switch (system) {
-                        case System::TI99_4A:
+                        case System::TI99_4A: {
+                            auto data = input.get_contents();
                             encode_ti(data.begin(), data.end(), tzx);
                             return;
+                        }
                             
                         default:
                             break;
@@ -163,9 +384,11 @@ static void convert(System::Type system, FileFormat::Type input_format, FileForm
                     auto tzx = TZX(outfile);
                     
                     switch (system) {
-                        case System::TI99_4A:
+                        case System::TI99_4A: {
+                            auto data = input.get_contents();
                             encode_ti(data.begin() + 20, data.end(), tzx);
                             break;
+                        }
                             
                         default:
                             break;
@@ -180,56 +403,509 @@ static void convert(System::Type system, FileFormat::Type input_format, FileForm
             
         }
             
+        case FileFormat::FLAC:
         case FileFormat::WAV: {
-            auto wav = Wav(data, Wav::RIGHT);
-            auto pulses = Pulses(wav);
+            auto source = std::unique_ptr<SampleSource>();
+            if (input_format == FileFormat::FLAC) {
+                source = std::make_unique<Flac>(input.data(), input.size(), SampleSource::RIGHT);
+            }
+            else {
+                source = std::make_unique<Wav>(input.data(), input.size(), SampleSource::RIGHT);
+            }
+            if (convert_samples(system, output_format, std::move(source), outfile)) {
+                return;
+            }
+            break;
+        }
             
-            switch (output_format) {
-                case FileFormat::TZX: {
-                    auto tzx = TZX(outfile);
-                    
-                    switch (system) {
-                        case System::TI99_4A: {
-                            auto decoder = TI99TapeDecoder(pulses.begin(), pulses.end());
-                            auto data = decoder.decode();
-                            encode_ti(data.begin(), data.end(), tzx);
-                            return;
+        default:
+            break;
+    }
+
+    throw Exception("cannot convert " + System::name(system) + " " + FileFormat::name(input_format) + " to " + FileFormat::name(output_format));
+}
+
+static bool convert_samples(System::Type system, FileFormat::Type output_format, std::unique_ptr<SampleSource> source, const std::string &outfile) {
+    if (pipeline) {
+        source = std::make_unique<ThreadedSampleSource>(std::move(source));
+    }
+    auto pulses = Pulses(std::move(source), resume_state.pulses);
+    pulses.use_bit_planes(bit_planes);
+    if (index_recording.has_value() && resume_state.pulses.position == 0) {
+        // Pulse numbers in the index count from the start of the recording.
+        new_index = std::make_unique<SeekIndex>();
+        pulses.record_states(SeekIndex::INTERVAL, [](size_t number, const Pulses::State &state) {
+            new_index->add_point(number, state);
+        });
+    }
+    if (pipeline) {
+        pulses.start_thread();
+    }
+    auto converted = false;
+    
+    try {
+        converted = convert_pulses(system, output_format, pulses, outfile);
+    }
+    catch (...) {
+        pulses.stop_thread();
+        if (verbose) {
+            pulses.diagnostics.print(stderr);
+        }
+        throw;
+    }
+    pulses.stop_thread();
+    if (verbose) {
+        pulses.diagnostics.print(stderr);
+    }
+    if (new_index) {
+        new_index->input = InputIdentity(stream_input, stream_data_offset);
+        new_index->save(SeekIndex::filename(index_recording.value()));
+    }
+    
+    return converted;
+}
+
+
+static bool convert_pulses(System::Type system, FileFormat::Type output_format, Pulses &pulses, const std::string &outfile) {
+    switch (output_format) {
+        case FileFormat::TZX: {
+            auto tzx = TZX(outfile);
+            
+            switch (system) {
+                case System::TI99_4A: {
+                    auto encoder = TI99TapeEncoder(tzx, false);
+                    encoder.timing = timing;
+                    if (all_files) {
+                        // Only files that were decoded completely are added.
+                        decode_all_ti(pulses, [&encoder](size_t, const std::vector<uint8_t> &data) {
+                            encoder.encode(data);
+                        });
+                        report_duration(tzx);
+                        return true;
+                    }
+                    // Encode each block as soon as it is decoded.
+                    auto data = decode_ti(pulses, [&encoder](const TI99TapeDecoder::Block &block) {
+                        if (block.index == 0) {
+                            encoder.begin_file(block.number_of_blocks);
                         }
-                            
-                        default:
-                            convert_wav(pulses, tzx);
-                            break;
+                        encoder.add_block(block.data, TI99TapeDecoder::BLOCK_SIZE);
+                    });
+                    if (data.empty()) {
+                        encoder.begin_file(0);
                     }
-                    break;
+                    encoder.end_file();
+                    report_duration(tzx);
+                    return true;
                 }
                     
-                case FileFormat::RAW: {
-                    switch (system) {
-                        case System::TI99_4A: {
-                            auto decoder = TI99TapeDecoder(pulses.begin(), pulses.end());
-                            auto data = decoder.decode();
-                            write_file(outfile, data);
-                            return;
-                        }
-                            
-                        default:
-                            break;
+                default:
+                    convert_wav(pulses, tzx);
+                    report_duration(tzx);
+                    return true;
+            }
+            break;
+        }
+            
+        case FileFormat::RAW: {
+            switch (system) {
+                case System::TI99_4A: {
+                    if (all_files) {
+                        decode_all_ti(pulses, [&outfile](size_t index, const std::vector<uint8_t> &data) {
+                            write_file(numbered_filename(outfile, index), data);
+                        });
+                        return true;
                     }
+                    auto data = decode_ti(pulses);
+                    write_file(outfile, data);
+                    return true;
                 }
+                    
                 default:
                     break;
             }
-            break;
         }
-            
         default:
             break;
     }
+    
+    return false;
+}
 
-    throw Exception("cannot convert " + System::name(system) + " " + FileFormat::name(input_format) + " to " + FileFormat::name(output_format));
+
+static std::vector<uint8_t> decode_ti(Pulses &pulses, std::function<void(const TI99TapeDecoder::Block &block)> block_callback) {
+    auto position = pulses.begin();
+    auto synced = false;
+    
+    // Read past the files before the selected one. Like in decode_all_ti, syncs without a valid header are not counted.
+    for (auto skip = files_to_skip; skip > 0;) {
+        auto decoder = TI99TapeDecoder(position, pulses.end());
+        decoder.index = new_index.get();
+        try {
+            decoder.decode();
+            skip -= 1;
+        }
+        catch (TI99TapeDecoder::DecodeException &ex) {
+            if (!decoder.synced()) {
+                break;
+            }
+            skip -= 1;
+        }
+        position = decoder.position();
+    }
+    
+    return decode_ti(position, pulses.end(), resume_state, block_callback, synced);
 }
 
+
+// Decode one file starting at position, which is advanced to where decoding stopped, even if it failed. synced tells whether the header of the file was read.
+static std::vector<uint8_t> decode_ti(Pulses::Iterator &position, Pulses::Iterator end, const TI99TapeDecoder::State &state, std::function<void(const TI99TapeDecoder::Block &block)> block_callback, bool &synced) {
+    auto decoder = TI99TapeDecoder(position, end, state);
+    decoder.verify = verify;
+    decoder.index = new_index.get();
+    
+    if (checkpoint_file.has_value()) {
+        decoder.checkpoint = [](const TI99TapeDecoder::State &state) {
+            auto saved = state;
+            if (!stream_input.empty()) {
+                saved.input = InputIdentity(stream_input, stream_data_offset);
+            }
+            saved.save(checkpoint_file.value());
+        };
+    }
+    decoder.block_callback = [block_callback](const TI99TapeDecoder::Block &block) {
+        if (verbose) {
+            fprintf(stderr, "block %u of %u: ", block.index + 1, block.number_of_blocks);
+            if (block.restored) {
+                fprintf(stderr, "restored\n");
+            }
+            else {
+                fprintf(stderr, "copy 0 %s, copy 1 %s%s\n", TI99TapeDecoder::DecodeException::name(block.status[0]).c_str(), block.copy_skipped ? "skipped" : TI99TapeDecoder::DecodeException::name(block.status[1]).c_str(), block.copies_differ ? ", copies differ" : "");
+            }
+        }
+        if (block_callback) {
+            block_callback(block);
+        }
+    };
+    
+    try {
+        auto data = decoder.decode();
+        position = decoder.position();
+        synced = true;
+        return data;
+    }
+    catch (...) {
+        position = decoder.position();
+        synced = decoder.synced();
+        throw;
+    }
+}
+
+
+// Decode the files on the recording one after the other, in a single pass over the pulses. Files that can't be decoded are reported and skipped, but still counted in index. Syncs without a valid header are not counted as files.
+static void decode_all_ti(Pulses &pulses, std::function<void(size_t index, const std::vector<uint8_t> &data)> file_callback) {
+    auto position = pulses.begin();
+    size_t index = 0;
+    size_t failed = 0;
+    
+    while (position != pulses.end()) {
+        auto synced = false;
+        try {
+            auto data = decode_ti(position, pulses.end(), TI99TapeDecoder::State(), nullptr, synced);
+            index += 1;
+            if (verbose) {
+                fprintf(stderr, "file %zu: %zu blocks\n", index, data.size() / TI99TapeDecoder::BLOCK_SIZE);
+            }
+            file_callback(index, data);
+        }
+        catch (TI99TapeDecoder::DecodeException &ex) {
+            if (!synced) {
+                continue;
+            }
+            index += 1;
+            failed += 1;
+            fprintf(stderr, "file %zu: %s\n", index, ex.what());
+        }
+    }
+    
+    if (index == 0) {
+        throw TI99TapeDecoder::DecodeException(TI99TapeDecoder::DecodeException::NO_SYNC, "no sync found");
+    }
+    if (failed > 0) {
+        throw Exception(std::to_string(failed) + " of " + std::to_string(index) + " files could not be decoded");
+    }
+}
+
+
+// Insert number before the extension of filename.
+static std::string numbered_filename(const std::string &filename, size_t number) {
+    auto path = std::filesystem::path(filename);
+    
+    return (path.parent_path() / (path.stem().string() + "-" + std::to_string(number) + path.extension().string())).string();
+}
+
+
 static void encode_ti(std::vector<uint8_t>::const_iterator begin, std::vector<uint8_t>::const_iterator end, TZX &tzx) {
     auto encoder = TI99TapeEncoder(tzx, false);
+    encoder.timing = timing;
     encoder.encode(begin, end);
+    report_duration(tzx);
+}
+
+
+static void report_duration(const TZX &tzx) {
+    if (verbose) {
+        fprintf(stderr, "playback duration %s\n", format_time(static_cast<double>(tzx.duration()) / 3500000).c_str());
+    }
+}
+
+
+// Open input for reading samples as they are needed, starting where a previous run left off or at --start, and stopping at --end. data_offset is the position of the first sample in the file, data_length the number of bytes of samples, Wav::UNKNOWN_LENGTH to read to the end of the file.
+static std::unique_ptr<PcmStream> open_stream(const std::string &filename, SampleFormat format, int sample_rate, uint64_t data_offset, uint64_t data_length) {
+    if (filename != "-") {
+        stream_input = filename;
+        stream_data_offset = data_offset;
+        if (checkpoint_file.has_value() && !resume_state.input.empty() && !resume_state.input.matches(filename, data_offset)) {
+            fprintf(stderr, "checkpoint '%s' is for a different recording, starting from the beginning\n", checkpoint_file->c_str());
+            resume_state = TI99TapeDecoder::State();
+        }
+    }
+    uint64_t start = 0;
+    if (start_time.has_value()) {
+        start = parse_time(start_time.value(), sample_rate);
+        if (!resume_state.synced && resume_state.pulses.position < start) {
+            resume_state.pulses = Pulses::State(start, Pulses::START, resume_state.pulses.peak);
+        }
+    }
+    seek_to_sync(start);
+    
+    auto stream = std::make_unique<PcmStream>(filename, format, sample_rate, SampleSource::RIGHT, data_offset + resume_state.pulses.position * format.frame_size(), follow);
+    
+    // While following, the recording is still growing past the sizes in its header.
+    auto end = std::optional<uint64_t>();
+    if (!follow && data_length != Wav::UNKNOWN_LENGTH) {
+        end = data_length / format.frame_size();
+    }
+    if (end_time.has_value()) {
+        auto end_position = parse_time(end_time.value(), sample_rate);
+        if (end_position <= resume_state.pulses.position) {
+            throw Exception("end time is not after start");
+        }
+        end = end.has_value() ? std::min(end.value(), end_position) : end_position;
+    }
+    if (end.has_value()) {
+        stream->limit(end.value() > resume_state.pulses.position ? end.value() - resume_state.pulses.position : 0);
+    }
+    
+    if (filename != "-" && !follow) {
+        // Use the same cutoff as when reading the whole file into memory, wherever decoding starts.
+        stream->measure_peak(data_offset, data_length);
+    }
+    
+    return stream;
+}
+
+
+// Convert samples read from filename as they are needed. If decoding fails after starting at the sync from the seek index, the index doesn't fit the recording, and the whole recording is decoded instead.
+static bool convert_stream(System::Type system, FileFormat::Type output_format, const std::string &filename, SampleFormat format, int sample_rate, uint64_t data_offset, uint64_t data_length, const std::string &outfile) {
+    try {
+        return convert_samples(system, output_format, open_stream(filename, format, sample_rate, data_offset, data_length), outfile);
+    }
+    catch (Exception &ex) {
+        if (!started_from_index) {
+            throw;
+        }
+        fprintf(stderr, "decoding from seek index failed (%s), decoding whole recording\n", ex.what());
+    }
+    
+    seek_index.reset();
+    started_from_index = false;
+    resume_state.pulses = Pulses::State();
+    return convert_samples(system, output_format, open_stream(filename, format, sample_rate, data_offset, data_length), outfile);
+}
+
+
+// Start pulse detection at the sync of the selected file after start, found by a previous run, unless resuming from a checkpoint. Sets files_to_skip to the number of files to read before the selected one.
+static void seek_to_sync(uint64_t start) {
+    files_to_skip = resume_state.synced ? 0 : file_number;
+    if (!seek_index.has_value() || resume_state.synced || resume_state.pulses.position > start) {
+        return;
+    }
+    if (!seek_index->matches(stream_input, stream_data_offset)) {
+        if (verbose) {
+            fprintf(stderr, "seek index is for a different recording, ignoring it\n");
+        }
+        seek_index.reset();
+        return;
+    }
+    auto first = seek_index->find_sync_after(start);
+    if (first == nullptr) {
+        return;
+    }
+    // If the index doesn't go as far as the selected file, continue from the last file it knows.
+    auto file = first->file + std::min(file_number, seek_index->number_of_files - 1 - first->file);
+    auto sync = seek_index->find_sync(file);
+    if (sync == nullptr) {
+        return;
+    }
+    resume_state.pulses = sync->state;
+    files_to_skip = first->file + file_number - file;
+    started_from_index = true;
+    if (verbose) {
+        fprintf(stderr, "starting at sample %" PRIu64 " from seek index\n", resume_state.pulses.position);
+    }
+}
+
+
+// List the files on a recording. The sync leaders are found by their tone, and only the header following each of them is decoded.
+static void scan_recording(const std::string &filename, SampleFormat format, int sample_rate, uint64_t data_offset, uint64_t data_length) {
+    if (filename == "-") {
+        throw Exception("can't scan standard input");
+    }
+    
+    auto source = open_stream(filename, format, sample_rate, data_offset, data_length);
+    auto start = resume_state.pulses.position;
+    auto scanner = LeaderScanner(sample_rate, 3500000.0 / (2 * TI99TapeEncoder::ZERO_PULSE_LENGTH));
+    const int16_t *samples;
+    size_t n;
+    while ((n = source->read(&samples)) > 0) {
+        scanner.add(samples, n);
+    }
+    scanner.finish();
+    
+    printf("%-10s %6s  %s\n", "start", "blocks", "duration");
+    for (auto &leader : scanner.leaders) {
+        auto leader_start = start + leader.start;
+        auto leader_end = start + leader.end;
+        
+        // Enough of the leader to measure the bit length, and the header after it.
+        auto header_start = std::max(leader_start, leader_end - std::min(leader_end, static_cast<uint64_t>(sample_rate)));
+        auto header_source = std::make_unique<PcmStream>(filename, format, sample_rate, SampleSource::RIGHT, data_offset + header_start * format.frame_size());
+        header_source->limit(leader_end - header_start + static_cast<uint64_t>(sample_rate / 2));
+        header_source->peak = source->peak;
+        auto pulses = Pulses(std::move(header_source), Pulses::State(header_start, Pulses::START, 0));
+        auto decoder = TI99TapeDecoder(pulses.begin(), pulses.end());
+        
+        auto start_time = format_time(static_cast<double>(leader_start) / sample_rate);
+        try {
+            auto number_of_blocks = decoder.read_header();
+            printf("%-10s %6u  %s\n", start_time.c_str(), number_of_blocks, format_time(static_cast<double>(decoder.file_duration()) / 3500000).c_str());
+        }
+        catch (TI99TapeDecoder::DecodeException &ex) {
+            printf("%-10s %6s  %s\n", start_time.c_str(), "?", ex.what());
+        }
+    }
+}
+
+
+// Encode several files into one TZX image, in order and with a pause between them. The files are encoded into memory on worker threads, each with its own encoder.
+static void encode_compilation(System::Type system, FileFormat::Type output_format, const std::vector<std::string> &infiles, const std::string &outfile) {
+    if (output_format != FileFormat::TZX || system != System::TI99_4A) {
+        throw Exception("combining several files is only supported for " + System::name(System::TI99_4A) + " TZX output");
+    }
+    
+    auto images = std::vector<std::unique_ptr<TZX>>(infiles.size());
+    auto errors = std::vector<std::exception_ptr>(infiles.size());
+    auto next = std::atomic<size_t>(0);
+    
+    auto worker = [&]() {
+        for (auto index = next++; index < infiles.size(); index = next++) {
+            try {
+                auto span = Trace::Span("encode file", static_cast<int64_t>(index));
+                auto format = FileFormat::by_file(infiles[index], system);
+                if (format != FileFormat::TI_TAPE && format != FileFormat::RAW && format != FileFormat::UNKNOWN) {
+                    throw Exception("cannot add " + FileFormat::name(format) + " file '" + infiles[index] + "' to TZX");
+                }
+                auto data = get_file_contents(infiles[index]);
+                auto start = data.cbegin();
+                if (format == FileFormat::TI_TAPE) {
+                    start += 20;
+                }
+                
+                images[index] = std::make_unique<TZX>();
+                auto encoder = TI99TapeEncoder(*images[index], false);
+                encoder.timing = timing;
+                encoder.encode(start, data.cend());
+            }
+            catch (...) {
+                errors[index] = std::current_exception();
+            }
+        }
+    };
+    
+    auto number_of_threads = std::min(infiles.size(), static_cast<size_t>(std::max(1u, std::thread::hardware_concurrency())));
+    auto threads = std::vector<std::thread>();
+    for (size_t i = 1; i < number_of_threads; i++) {
+        threads.emplace_back([&worker]() {
+            Trace::name_thread("encode");
+            worker();
+        });
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    
+    for (auto &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    
+    auto tzx = TZX(outfile);
+    for (size_t index = 0; index < images.size(); index++) {
+        if (index > 0 && timing.pause > 0) {
+            tzx.add_pause(timing.pause);
+        }
+        tzx.add_blocks(*images[index]);
+    }
+    report_duration(tzx);
+}
+
+
+// Decode each channel of the input on its own thread, reading the input only once. The result of each channel is written to a numbered output file.
+static void decode_channels(System::Type system, FileFormat::Type output_format, std::unique_ptr<PcmStream> stream, const std::string &outfile) {
+    auto splitter = ChannelSplitter(std::move(stream));
+    auto errors = std::vector<std::exception_ptr>(splitter.channels());
+    auto threads = std::vector<std::thread>();
+    
+    for (size_t channel = 0; channel < splitter.channels(); channel++) {
+        threads.emplace_back([&, channel]() {
+            Trace::name_thread("channel " + std::to_string(channel + 1));
+            try {
+                auto pulses = Pulses(splitter.source(channel), resume_state.pulses);
+                pulses.use_bit_planes(bit_planes);
+                if (pipeline) {
+                    pulses.start_thread();
+                }
+                if (!convert_pulses(system, output_format, pulses, numbered_filename(outfile, channel + 1))) {
+                    throw Exception("cannot convert " + System::name(system) + " audio to " + FileFormat::name(output_format));
+                }
+            }
+            catch (...) {
+                errors[channel] = std::current_exception();
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    
+    size_t failed = 0;
+    for (size_t channel = 0; channel < errors.size(); channel++) {
+        if (errors[channel]) {
+            failed += 1;
+            try {
+                std::rethrow_exception(errors[channel]);
+            }
+            catch (std::exception &ex) {
+                fprintf(stderr, "channel %zu: %s\n", channel + 1, ex.what());
+            }
+        }
+        else if (verbose) {
+            fprintf(stderr, "channel %zu: ok\n", channel + 1);
+        }
+    }
+    if (failed > 0) {
+        throw Exception(std::to_string(failed) + " of " + std::to_string(errors.size()) + " channels could not be decoded");
+    }
 }
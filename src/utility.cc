@@ -30,10 +30,21 @@
 
 #include "utility.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 
+#include "Exception.h"
+#include "Stats.h"
+#include "Trace.h"
+
 std::vector<uint8_t> get_file_contents(const std::string &filename) {
+    auto timer = Stats::Timer(Stats::READ);
+    auto span = Trace::Span("read file");
     auto file = std::ifstream(filename, std::ios::binary);
     auto data = std::vector<uint8_t>();
     data.reserve(std::filesystem::file_size(filename));
@@ -43,6 +54,21 @@ std::vector<uint8_t> get_file_contents(const std::string &filename) {
 }
 
 
+std::vector<uint8_t> get_file_part(const std::string &filename, uint64_t offset, size_t length) {
+    auto timer = Stats::Timer(Stats::READ);
+    auto file = std::ifstream(filename, std::ios::binary);
+    if (!file) {
+        throw Exception("can't open '" + filename + "': " + strerror(errno));
+    }
+    auto data = std::vector<uint8_t>(length);
+    file.seekg(static_cast<std::streamoff>(offset));
+    file.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(length));
+    data.resize(static_cast<size_t>(std::max(file.gcount(), static_cast<std::streamsize>(0))));
+    
+    return data;
+}
+
+
 size_t number_of_bits(uint64_t value) {
     size_t i = 0;
     while (value > (1 << i)) {
@@ -53,7 +79,137 @@ size_t number_of_bits(uint64_t value) {
 }
 
 
+uint64_t parse_number(const std::string &string, const std::string &what) {
+    char *end;
+    errno = 0;
+    auto value = strtoull(string.c_str(), &end, 10);
+    if (string.empty() || *end != '\0' || errno != 0 || string[0] == '-') {
+        throw Exception("invalid " + what + " '" + string + "'");
+    }
+    
+    return value;
+}
+
+
+uint64_t parse_time(const std::string &string, int sample_rate) {
+    static const auto samples_suffix = std::string("smp");
+    
+    if (string.size() > samples_suffix.size() && string.compare(string.size() - samples_suffix.size(), samples_suffix.size(), samples_suffix) == 0) {
+        return parse_number(string.substr(0, string.size() - samples_suffix.size()), "time");
+    }
+    
+    auto time = string;
+    if (!time.empty() && time.back() == 's') {
+        time.pop_back();
+    }
+    
+    double seconds = 0;
+    size_t start = 0;
+    for (auto fields = 0; fields < 3; fields++) {
+        auto colon = time.find(':', start);
+        auto field = time.substr(start, colon == std::string::npos ? std::string::npos : colon - start);
+        char *end;
+        errno = 0;
+        auto value = strtod(field.c_str(), &end);
+        if (field.empty() || *end != '\0' || errno != 0 || !std::isfinite(value) || value < 0 || field[0] == '-' || field[0] == '+') {
+            throw Exception("invalid time '" + string + "'");
+        }
+        seconds = seconds * 60 + value;
+        if (colon == std::string::npos) {
+            return static_cast<uint64_t>(std::llround(seconds * sample_rate));
+        }
+        start = colon + 1;
+    }
+    
+    throw Exception("invalid time '" + string + "'");
+}
+
+
+std::string format_time(double seconds) {
+    auto tenths = static_cast<uint64_t>(std::llround(seconds * 10));
+    auto minutes = tenths / 600;
+    char buffer[64];
+    
+    if (minutes >= 60) {
+        snprintf(buffer, sizeof(buffer), "%u:%02u:%04.1f", static_cast<unsigned int>(minutes / 60), static_cast<unsigned int>(minutes % 60), static_cast<double>(tenths % 600) / 10);
+    }
+    else {
+        snprintf(buffer, sizeof(buffer), "%u:%04.1f", static_cast<unsigned int>(minutes), static_cast<double>(tenths % 600) / 10);
+    }
+    
+    return buffer;
+}
+
+
 void write_file(const std::string &filename, const std::vector<uint8_t> &data) {
+    auto timer = Stats::Timer(Stats::ENCODE);
     auto file = std::ofstream(filename, std::ios::binary);
     file.write(reinterpret_cast<const char *>(data.data()), data.size());
 }
+
+
+// xxHash64
+uint64_t hash_data(const uint8_t *data, size_t length, uint64_t seed) {
+    const uint64_t prime1 = 0x9e3779b185ebca87;
+    const uint64_t prime2 = 0xc2b2ae3d27d4eb4f;
+    const uint64_t prime3 = 0x165667b19e3779f9;
+    const uint64_t prime4 = 0x85ebca77c2b2ae63;
+    const uint64_t prime5 = 0x27d4eb2f165667c5;
+    
+    auto rotate = [](uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); };
+    auto round = [&](uint64_t accumulator, uint64_t input) { return rotate(accumulator + input * prime2, 31) * prime1; };
+    auto merge = [&](uint64_t accumulator, uint64_t value) { return (accumulator ^ round(0, value)) * prime1 + prime4; };
+    auto read_64 = [](const uint8_t *p) { uint64_t value; memcpy(&value, p, 8); return value; };
+    auto read_32 = [](const uint8_t *p) { uint32_t value; memcpy(&value, p, 4); return value; };
+    
+    auto p = data;
+    auto end = data + length;
+    uint64_t h;
+    
+    if (length >= 32) {
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+        
+        for (; end - p >= 32; p += 32) {
+            v1 = round(v1, read_64(p));
+            v2 = round(v2, read_64(p + 8));
+            v3 = round(v3, read_64(p + 16));
+            v4 = round(v4, read_64(p + 24));
+        }
+        
+        h = rotate(v1, 1) + rotate(v2, 7) + rotate(v3, 12) + rotate(v4, 18);
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    }
+    else {
+        h = seed + prime5;
+    }
+    
+    h += length;
+    
+    for (; end - p >= 8; p += 8) {
+        h ^= round(0, read_64(p));
+        h = rotate(h, 27) * prime1 + prime4;
+    }
+    if (end - p >= 4) {
+        h ^= read_32(p) * prime1;
+        h = rotate(h, 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * prime5;
+        h = rotate(h, 11) * prime1;
+    }
+    
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    
+    return h;
+}
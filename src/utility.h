@@ -33,10 +33,20 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <string>
 #include <vector>
 
 std::vector<uint8_t> get_file_contents(const std::string &filename);
+// Read at most length bytes starting at offset.
+std::vector<uint8_t> get_file_part(const std::string &filename, uint64_t offset, size_t length);
+// xxHash64 of data.
+uint64_t hash_data(const uint8_t *data, size_t length, uint64_t seed = 0);
 size_t number_of_bits(uint64_t value);
+uint64_t parse_number(const std::string &string, const std::string &what);
+// Parse a position in a recording as seconds (optionally followed by 's'), minutes:seconds or hours:minutes:seconds, or as a number of samples followed by 'smp'. Returns the number of samples.
+uint64_t parse_time(const std::string &string, int sample_rate);
+// Format seconds as [h:]mm:ss.s.
+std::string format_time(double seconds);
 void write_file(const std::string &filename, const std::vector<uint8_t> &data);
 
 #endif // HAD_UTILITY_H